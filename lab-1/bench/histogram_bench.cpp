@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "containers/vector.hpp"
+#include "containers/vector_tools.hpp"
+
+namespace tc = tools::containers;
+namespace vt = tools::containers::vector_tools;
+
+namespace {
+
+constexpr const size_t kSize = 1 << 22;
+constexpr const size_t kChunkSize = 1 << 16;
+constexpr const size_t kKeyRange = 1'000'000;
+constexpr const int kRepeats = 10;
+
+tc::Vector<vt::KeyIndex> Uniform(std::mt19937_64 &rng) {
+  std::uniform_int_distribution<size_t> dist(0, kKeyRange - 1);
+  tc::Vector<vt::KeyIndex> v(kSize);
+  for (size_t i(0); i < kSize; ++i) {
+    v[i] = {dist(rng), static_cast<uint32_t>(i)};
+  }
+  return v;
+}
+
+// Zipf over [0, kKeyRange) by inverting the CDF, rank r has weight 1/r^s.
+tc::Vector<vt::KeyIndex> Zipf(std::mt19937_64 &rng, double s) {
+  std::vector<double> cdf(kKeyRange);
+  double sum = 0;
+  for (size_t r(0); r < kKeyRange; ++r) {
+    sum += 1.0 / std::pow(static_cast<double>(r + 1), s);
+    cdf[r] = sum;
+  }
+  std::uniform_real_distribution<double> dist(0, sum);
+  tc::Vector<vt::KeyIndex> v(kSize);
+  for (size_t i(0); i < kSize; ++i) {
+    const auto it = std::lower_bound(cdf.begin(), cdf.end(), dist(rng));
+    v[i] = {static_cast<size_t>(it - cdf.begin()), static_cast<uint32_t>(i)};
+  }
+  return v;
+}
+
+template <typename Kernel>
+double BestNsPerKey(const tc::Vector<vt::KeyIndex> &v, size_t n, size_t shift,
+                    size_t mask, size_t buckets, Kernel kernel) {
+  constexpr const size_t kStride = sizeof(vt::KeyIndex) / sizeof(size_t);
+  std::vector<size_t> count(buckets);
+  double best = 1e100;
+  for (int r(0); r < kRepeats; ++r) {
+    std::fill(count.begin(), count.end(), 0);
+    const auto start = std::chrono::steady_clock::now();
+    kernel(&v.Data()->key, kStride, n, shift, mask, count.data(), buckets);
+    const auto stop = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::nano>(stop - start).count());
+  }
+  return best / static_cast<double>(n);
+}
+
+void Run(const std::string &name, const tc::Vector<vt::KeyIndex> &v) {
+  struct Digit {
+    const char *name;
+    size_t shift;
+    size_t mask;
+    size_t buckets;
+  };
+  const Digit digits[] = {
+      {"radix-11", 0, (1 << 11) - 1, 1 << 11},
+      {"radix-16", 0, (1 << 16) - 1, 1 << 16},
+  };
+
+  for (const size_t n : {kChunkSize, kSize}) {
+    for (const auto &d : digits) {
+      const double naive = BestNsPerKey(
+          v, n, d.shift, d.mask, d.buckets,
+          [](const size_t *k, size_t s, size_t n, size_t sh, size_t m,
+             size_t *c, size_t) { vt::HistogramNaive(k, s, n, sh, m, c); });
+      const double scalar = BestNsPerKey(v, n, d.shift, d.mask, d.buckets,
+                                         vt::HistogramScalar);
+      std::cout << std::left << std::setw(10) << name << std::setw(10)
+                << d.name << std::setw(9) << n << std::fixed
+                << std::setprecision(3) << " naive " << naive
+                << " ns/key, sub-histograms " << scalar << " ns/key (x"
+                << naive / scalar << ")";
+#ifdef __x86_64__
+      if (__builtin_cpu_supports("avx2")) {
+        const double avx2 = BestNsPerKey(v, n, d.shift, d.mask, d.buckets,
+                                         vt::HistogramAvx2);
+        std::cout << ", avx2 " << avx2 << " ns/key (x" << naive / avx2 << ")";
+      }
+#endif
+      std::cout << '\n';
+    }
+  }
+}
+
+} // namespace
+
+int main() {
+  std::mt19937_64 rng(20240601);
+  Run("uniform", Uniform(rng));
+  Run("zipf-1.1", Zipf(rng, 1.1));
+  Run("zipf-2", Zipf(rng, 2.0));
+  Run("equal", Zipf(rng, 50.0));
+  return 0;
+}
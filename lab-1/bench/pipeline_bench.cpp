@@ -0,0 +1,253 @@
+// Phase-by-phase benchmark of the lab-1 pipeline on generated inputs.
+// Prints CSV: dataset,records,phase,impl,seconds,ns_per_record
+//
+// lab-1-pipeline-bench [-n RECORDS] [-s SEED] [-t THREADS] [-r REPEATS]
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "containers/vector.hpp"
+#include "containers/vector_tools.hpp"
+#include "io/input_buffer.hpp"
+#include "io/output_buffer.hpp"
+
+namespace tc = tools::containers;
+namespace tio = tools::io;
+namespace vt = tools::containers::vector_tools;
+
+namespace {
+
+constexpr const size_t kKeyRange = 1'000'000;
+constexpr const size_t kShortValue = 8;
+constexpr const size_t kLongValue = 200;
+
+using TV = std::pair<size_t, std::string_view>;
+
+struct Config {
+  size_t records = 1'000'000;
+  uint64_t seed = 1;
+  size_t threads = 1;
+  int repeats = 3;
+};
+
+enum class Keys { kUniform, kZipf, kEqual, kSorted, kReversed };
+
+struct Dataset {
+  std::string name;
+  Keys keys;
+  size_t value_size;
+};
+
+std::vector<size_t> MakeKeys(Keys kind, size_t n, std::mt19937_64 &rng) {
+  std::vector<size_t> keys(n);
+  switch (kind) {
+  case Keys::kUniform: {
+    std::uniform_int_distribution<size_t> dist(0, kKeyRange - 1);
+    for (auto &k : keys) {
+      k = dist(rng);
+    }
+    break;
+  }
+  case Keys::kZipf: {
+    std::vector<double> cdf(kKeyRange);
+    double sum = 0;
+    for (size_t r(0); r < kKeyRange; ++r) {
+      sum += 1.0 / std::pow(static_cast<double>(r + 1), 1.1);
+      cdf[r] = sum;
+    }
+    std::uniform_real_distribution<double> dist(0, sum);
+    for (auto &k : keys) {
+      k = std::lower_bound(cdf.begin(), cdf.end(), dist(rng)) - cdf.begin();
+    }
+    break;
+  }
+  case Keys::kEqual:
+    std::fill(keys.begin(), keys.end(), 424242);
+    break;
+  case Keys::kSorted:
+  case Keys::kReversed:
+    for (size_t i(0); i < n; ++i) {
+      keys[i] = i * kKeyRange / n;
+    }
+    if (kind == Keys::kReversed) {
+      std::reverse(keys.begin(), keys.end());
+    }
+    break;
+  }
+  return keys;
+}
+
+// Text in the lab-1 input format: zero-padded key, tab, value, newline.
+std::string MakeInput(const Dataset &d, size_t n, std::mt19937_64 &rng) {
+  const auto keys = MakeKeys(d.keys, n, rng);
+  std::uniform_int_distribution<int> letter('a', 'z');
+  std::string text;
+  text.reserve(n * (d.value_size + 8));
+  for (size_t i(0); i < n; ++i) {
+    std::string key = std::to_string(keys[i]);
+    text.append(key.size() < 6 ? 6 - key.size() : 0, '0');
+    text += key;
+    text += '\t';
+    for (size_t j(0); j < d.value_size; ++j) {
+      text += static_cast<char>(letter(rng));
+    }
+    text += '\n';
+  }
+  return text;
+}
+
+template <typename Fn> double BestSeconds(int repeats, Fn run) {
+  double best = 1e100;
+  for (int r(0); r < repeats; ++r) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const auto stop = std::chrono::steady_clock::now();
+    best = std::min(best,
+                    std::chrono::duration<double>(stop - start).count());
+  }
+  return best;
+}
+
+void Report(const std::string &dataset, size_t n, const char *phase,
+            const char *impl, double seconds) {
+  std::cout << dataset << ',' << n << ',' << phase << ',' << impl << ','
+            << seconds << ',' << seconds * 1e9 / static_cast<double>(n)
+            << '\n';
+}
+
+tc::Vector<TV> Parse(const std::string &text) {
+  tio::RecordParser parser(text.data(), text.size());
+  tc::Vector<TV> v;
+  TV tmp;
+  while (parser.Next(tmp.first, tmp.second)) {
+    v.PushBack(tmp);
+  }
+  return v;
+}
+
+tc::Vector<TV> Copy(const tc::Vector<TV> &v) {
+  tc::Vector<TV> res(v.Size());
+  for (size_t i(0); i < v.Size(); ++i) {
+    res[i] = v[i];
+  }
+  return res;
+}
+
+void Check(bool ok, const std::string &what) {
+  if (!ok) {
+    throw std::runtime_error("Result mismatch: " + what);
+  }
+}
+
+void Run(const Dataset &d, const Config &config, std::mt19937_64 &rng) {
+  const std::string text = MakeInput(d, config.records, rng);
+  const size_t n = config.records;
+  const auto key = [](const TV &p) { return p.first; };
+
+  tc::Vector<TV> parsed;
+  Report(d.name, n, "parse", "RecordParser",
+         BestSeconds(config.repeats, [&] { parsed = Parse(text); }));
+  Check(parsed.Size() == n, d.name + " parse");
+
+  std::vector<TV> expected(parsed.Data(), parsed.Data() + parsed.Size());
+  Report(d.name, n, "sort", "std::stable_sort",
+         BestSeconds(config.repeats, [&] {
+           expected.assign(parsed.Data(), parsed.Data() + parsed.Size());
+           std::stable_sort(expected.begin(), expected.end(),
+                            [](const TV &l, const TV &r) {
+                              return l.first < r.first;
+                            });
+         }));
+
+  tc::Vector<TV> sorted;
+  Report(d.name, n, "sort", "LinearStableSort",
+         BestSeconds(config.repeats, [&] {
+           sorted = Copy(parsed);
+           vt::LinearStableSort(sorted, key, config.threads);
+         }));
+  for (size_t i(0); i < n; ++i) {
+    Check(sorted[i] == expected[i], d.name + " LinearStableSort");
+  }
+
+  tc::Vector<vt::KeyIndex> order;
+  Report(d.name, n, "sort", "SortedKeyIndex",
+         BestSeconds(config.repeats, [&] {
+           order = vt::SortedKeyIndex(parsed, key, config.threads);
+         }));
+  for (size_t i(0); i < n; ++i) {
+    Check(parsed[order[i].index] == expected[i], d.name + " SortedKeyIndex");
+  }
+
+  const int null_fd = open("/dev/null", O_WRONLY);
+  Report(d.name, n, "output", "OutputBuffer",
+         BestSeconds(config.repeats, [&] {
+           tio::OutputBuffer out(null_fd);
+           for (size_t i(0); i < n; ++i) {
+             out.WriteZeroPadded(order[i].key, 6);
+             out.Put('\t');
+             out.Write(parsed[order[i].index].second);
+             out.Put('\n');
+           }
+           out.Flush();
+         }));
+  close(null_fd);
+}
+
+Config ParseConfig(int argc, char *argv[]) {
+  Config config;
+  for (int i(1); i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      throw std::invalid_argument("Missing value for " + arg);
+    }
+    if (arg == "-n") {
+      config.records = std::stoul(argv[++i]);
+    } else if (arg == "-s") {
+      config.seed = std::stoull(argv[++i]);
+    } else if (arg == "-t") {
+      config.threads = std::stoul(argv[++i]);
+    } else if (arg == "-r") {
+      config.repeats = std::stoi(argv[++i]);
+    } else {
+      throw std::invalid_argument("Unknown option: " + arg);
+    }
+  }
+  return config;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    const Config config = ParseConfig(argc, argv);
+    const std::vector<Dataset> datasets = {
+        {"uniform-short", Keys::kUniform, kShortValue},
+        {"uniform-long", Keys::kUniform, kLongValue},
+        {"zipf-short", Keys::kZipf, kShortValue},
+        {"equal-short", Keys::kEqual, kShortValue},
+        {"sorted-short", Keys::kSorted, kShortValue},
+        {"reversed-short", Keys::kReversed, kShortValue},
+    };
+
+    std::mt19937_64 rng(config.seed);
+    std::cout << "dataset,records,phase,impl,seconds,ns_per_record\n";
+    for (const auto &d : datasets) {
+      Run(d, config, rng);
+    }
+  } catch (const std::exception &ex) {
+    std::cerr << ex.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
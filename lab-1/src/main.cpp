@@ -3,6 +3,7 @@
 #include "containers/string.hpp"
 #include "containers/vector.hpp"
 #include "containers/vector_tools.hpp"
+#include "memory/alloc_stats.hpp"
 
 namespace tc = tools::containers;
 namespace vt = tools::containers::vector_tools;
@@ -21,6 +22,7 @@ std::istream &operator>>(std::istream &is, Pair<Tf, Ts> &p) {
 using TV = Pair<size_t, tc::String>;
 
 int main() {
+  tools::memory::DumpAllocStatsAtExit();
   tc::Vector<TV> v;
   v.Reserve(10000);
   TV tmp;
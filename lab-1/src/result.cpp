@@ -1,13 +1,37 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <concepts>
+#include <type_traits>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
-#include <functional>
-#include <iomanip>
+#include <fstream>
+#include <initializer_list>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <new>
+#include <queue>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #ifdef LOCAL
 #define _GLIBCXX_DEBUG
@@ -18,83 +42,375 @@
 #endif
 
 namespace {
-constexpr const float kArrayResizeK = 1.5;
+constexpr const size_t kArrayResizeK = 2;
 constexpr const size_t kArrayInitSize = 2;
+constexpr const size_t kArrayInitCapacity = 4;
+constexpr const size_t kRadixDigitBits = 11;
+constexpr const size_t kRadixDigitSize = size_t(1) << kRadixDigitBits;
+constexpr const size_t kRadixDigitMask = kRadixDigitSize - 1;
+constexpr const size_t kCountingRangeFactor = 8;
+constexpr const size_t kParallelMinChunk = 1 << 16;
+constexpr const size_t kSubHistograms = 4;
+// The sub-histograms are kSubHistograms uint32_t lanes per bucket: 64 KiB at
+// this cap, where 2^16 buckets would take 1 MiB.
+constexpr const size_t kSubHistogramMaxBuckets = 1 << 12;
+constexpr const uint32_t kBucketFirstChunk = 2;
+constexpr const uint32_t kBucketMaxChunk = 256;
+constexpr const size_t kBucketSegmentBits = 16;
+constexpr const size_t kBucketSegmentSize = size_t(1) << kBucketSegmentBits;
+constexpr const size_t kBucketKeys = 1'000'000;
+constexpr const size_t kInputBlockSize = 1 << 20;
+constexpr const size_t kOutputBufferSize = 1 << 20;
+constexpr const size_t kExternalDefaultBudget = size_t(1) << 30;
+constexpr const size_t kMaxThreads = 1024;
+constexpr const size_t kMaxBudgetMiB = size_t(1) << 20;
+constexpr const size_t kRunMinBlockSize = 1 << 16;
+constexpr const size_t kMaxOpenRuns = 256;
 } // namespace
 
+namespace tools::memory {
+
+// Container families that report their heap traffic.
+enum class AllocSite {
+  kVector,
+  kSmallVector,
+  kString,
+  kAVLTree,
+  kStringPool,
+  kSiteCount
+};
+
+// Opt-in heap accounting: build with -DALLOC_STATS to count, per container
+// family, the buffers taken and given back, how many of them replaced a
+// smaller buffer on growth, and the bytes live now and at peak. Without the
+// flag every hook below is an empty inline function and compiles away.
+//
+// Bytes are what the container asked for, not what malloc rounded them up to.
+// Storage placed in an Arena is counted where the container requested it;
+// the arena's own blocks are not counted again.
+#ifdef ALLOC_STATS
+
+namespace alloc_stats_internal {
+
+struct Counters {
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> deallocations{0};
+  std::atomic<size_t> reallocations{0};
+  std::atomic<size_t> live_bytes{0};
+  std::atomic<size_t> peak_bytes{0};
+};
+
+// One slot per site plus a process-wide total, so the total peak is a real
+// high-water mark rather than a sum of peaks reached at different times.
+inline Counters &Slot(AllocSite site) {
+  static Counters table[static_cast<size_t>(AllocSite::kSiteCount) + 1];
+  return table[static_cast<size_t>(site)];
+}
+
+inline void AddLive(Counters &c, size_t bytes) {
+  const size_t live =
+      c.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+  while (peak < live && !c.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+} // namespace alloc_stats_internal
+
+inline void RecordAllocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->allocations.fetch_add(1, std::memory_order_relaxed);
+    alloc_stats_internal::AddLive(*c, bytes);
+  }
+}
+
+inline void RecordDeallocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->deallocations.fetch_add(1, std::memory_order_relaxed);
+    c->live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+}
+
+// Marks that a live buffer was replaced by a bigger one. The new buffer and
+// the release of the old one are recorded separately.
+inline void RecordReallocation(AllocSite site) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->reallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void DumpAllocStats(std::ostream &os) {
+  static const char *const kNames[] = {"Vector",  "SmallVector", "String",
+                                       "AVLTree", "StringPool",  "total"};
+  char line[128];
+  std::snprintf(line, sizeof(line), "%-12s %12s %12s %12s %14s %14s\n",
+                "alloc stats", "allocs", "frees", "reallocs", "live bytes",
+                "peak bytes");
+  os << line;
+  for (size_t i(0); i <= static_cast<size_t>(AllocSite::kSiteCount); ++i) {
+    const auto &c = alloc_stats_internal::Slot(static_cast<AllocSite>(i));
+    std::snprintf(line, sizeof(line), "%-12s %12zu %12zu %12zu %14zu %14zu\n",
+                  kNames[i], c.allocations.load(), c.deallocations.load(),
+                  c.reallocations.load(), c.live_bytes.load(),
+                  c.peak_bytes.load());
+    os << line;
+  }
+  os.flush();
+}
+
+// Prints the table to stderr when the program exits. Call once from main;
+// repeated calls register a single dump.
+inline void DumpAllocStatsAtExit() {
+  static const bool registered =
+      std::atexit([] { DumpAllocStats(std::cerr); }) == 0;
+  (void)registered;
+}
+
+#else
+
+inline void RecordAllocation(AllocSite, size_t) {}
+inline void RecordDeallocation(AllocSite, size_t) {}
+inline void RecordReallocation(AllocSite) {}
+inline void DumpAllocStats(std::ostream &) {}
+inline void DumpAllocStatsAtExit() {}
+
+#endif
+
+} // namespace tools::memory
+
 namespace tools::containers {
 
-template <typename T> class Vector {
-public:
-  Vector() {
-    size_ = 0;
-    capacity_ = 4;
-    data_ = new T[capacity_];
+// Tells Vector that a T can be moved to another address by copying its bytes
+// and forgetting the original, without calling its move constructor and
+// destructor. Holds for trivially copyable types; specialize it to true for
+// other types that keep no pointers into themselves.
+template <typename T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+template <typename T, typename D>
+struct IsTriviallyRelocatable<std::unique_ptr<T, D>>
+    : IsTriviallyRelocatable<D> {};
+
+template <typename T>
+struct IsTriviallyRelocatable<std::shared_ptr<T>> : std::true_type {};
+
+// Bounds checking policies for Vector::operator[]. At() always checks.
+struct CheckedAccess {
+  static void Check(size_t n, size_t size) {
+    if (n >= size) {
+      throw std::range_error("");
+    }
   }
+};
 
-  explicit Vector(size_t size) {
-    size_ = size;
+// Checks only in DEBUG builds, so release hot loops index unchecked and the
+// compiler is free to vectorize them.
+struct DebugCheckedAccess {
+  static void Check([[maybe_unused]] size_t n, [[maybe_unused]] size_t size) {
+#ifdef DEBUG
+    CheckedAccess::Check(n, size);
+#endif
+  }
+};
 
-    capacity_ = size;
+struct UncheckedAccess {
+  static void Check(size_t, size_t) noexcept {}
+};
+
+// Growth policies: Next gives the capacity after a full buffer, Fit the
+// capacity Reserve and the sizing constructors round a request up to.
+// GeometricGrowth multiplies the capacity by Num / Den.
+template <size_t Num, size_t Den = 1> struct GeometricGrowth {
+  static_assert(Num > Den, "Growth factor must be above 1");
 
-    data_ = new T[capacity_];
+  static size_t Next(size_t capacity) {
+    if (capacity == 0) {
+      return kArrayInitCapacity;
+    }
+    const size_t step = capacity * (Num - Den) / Den;
+    return capacity + (step == 0 ? 1 : step);
   }
 
-  Vector(size_t size, const T &default_value) {
-    size_ = size;
+  static size_t Fit(size_t capacity) {
+    size_t res = 2;
+    while (res < capacity) {
+      res = Next(res);
+    }
+    return res;
+  }
+};
 
-    capacity_ = size;
+// Geometric until the buffer holds Step elements, then Step more at a time,
+// so a huge array wastes at most Step slots instead of a constant fraction
+// of itself. Together with the realloc path the extra steps are cheap.
+template <size_t Step, size_t Num = kArrayResizeK, size_t Den = 1>
+struct SteppedGrowth {
+  static_assert(Step > 0, "Step must be positive");
 
-    data_ = new T[capacity_];
+  static size_t Next(size_t capacity) {
+    return capacity < Step ? GeometricGrowth<Num, Den>::Next(capacity)
+                           : capacity + Step;
+  }
+
+  static size_t Fit(size_t capacity) {
+    return capacity <= Step ? GeometricGrowth<Num, Den>::Fit(capacity)
+                            : (capacity + Step - 1) / Step * Step;
+  }
+};
+
+// Storage comes from Alloc (std::allocator by default, rebound to T). The
+// allocator always travels with the buffer: copies take the source's
+// allocator as select_on_container_copy_construction gives it, and moves and
+// assignments adopt the allocator together with the elements.
+//
+// Bounds picks how operator[] validates its index and Growth how the
+// capacity grows; both are stateless policy types from above.
+template <typename T, typename Alloc = std::allocator<T>,
+          typename Bounds = CheckedAccess,
+          typename Growth = GeometricGrowth<kArrayResizeK>>
+class Vector {
+  using Allocator =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  using AllocTraits = std::allocator_traits<Allocator>;
+
+  static constexpr bool kRelocateBytes = IsTriviallyRelocatable<T>::value;
+  // Such elements in default-allocated storage grow through realloc, which
+  // for large buffers remaps pages instead of copying them and never holds
+  // the old and the new buffer at once.
+  static constexpr bool kUseRealloc =
+      kRelocateBytes && std::is_same_v<Allocator, std::allocator<T>> &&
+      alignof(T) <= alignof(std::max_align_t);
+
+public:
+  Vector() = default;
+
+  explicit Vector(const Alloc &alloc) noexcept : alloc_(alloc) {}
 
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = default_value;
+  explicit Vector(size_t size, const Alloc &alloc = Alloc()) : alloc_(alloc) {
+    Reallocate(RoundCapacity(size));
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T();
     }
   }
 
-  Vector(Vector &&v) noexcept {
-    capacity_ = v.capacity;
-    size_ = v.Size();
-    delete[] data_;
-    data_ = v.data_;
+  Vector(size_t size, const T &default_value, const Alloc &alloc = Alloc())
+      : alloc_(alloc) {
+    Reallocate(RoundCapacity(size));
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T(default_value);
+    }
+  }
+
+  Vector(std::initializer_list<T> list, const Alloc &alloc = Alloc())
+      : alloc_(alloc) {
+    Reallocate(RoundCapacity(list.size()));
+    for (const T &el : list) {
+      new (data_ + size_) T(el);
+      ++size_;
+    }
+  }
+
+  Vector(const Vector &v)
+      : alloc_(AllocTraits::select_on_container_copy_construction(v.alloc_)) {
+    Reallocate(v.capacity_);
+    for (; size_ < v.size_; ++size_) {
+      new (data_ + size_) T(v.data_[size_]);
+    }
+  }
+
+  Vector(Vector &&v) noexcept
+      : data_(v.data_), size_(v.size_), capacity_(v.capacity_),
+        alloc_(v.alloc_) {
     v.data_ = nullptr;
     v.capacity_ = 0;
     v.size_ = 0;
   }
 
-  void PushBack(const T &elem) {
-    if (size_ + 1 > capacity_) {
-      capacity_ *= kArrayResizeK;
-      Reallocate();
+  void PushBack(const T &elem) { EmplaceBack(elem); }
+
+  void PushBack(T &&elem) { EmplaceBack(std::move(elem)); }
+
+  // On growth the new element is built before the old ones are relocated,
+  // so arguments referring into this vector stay valid.
+  template <typename... Args> T &EmplaceBack(Args &&...args) {
+    if (size_ < capacity_) {
+      new (data_ + size_) T(std::forward<Args>(args)...);
+      return data_[size_++];
     }
-    data_[size_++] = elem;
+    const size_t capacity = NextCapacity();
+    if constexpr (kUseRealloc) {
+      T value(std::forward<Args>(args)...);
+      Reallocate(capacity);
+      new (data_ + size_) T(std::move(value));
+      return data_[size_++];
+    }
+    T *new_data = Allocate(capacity);
+    try {
+      new (new_data + size_) T(std::forward<Args>(args)...);
+    } catch (...) {
+      Deallocate(new_data, capacity);
+      throw;
+    }
+    try {
+      Relocate(new_data, capacity);
+    } catch (...) {
+      new_data[size_].~T();
+      Deallocate(new_data, capacity);
+      throw;
+    }
+    return data_[size_++];
   }
 
   void Reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      Reallocate(RoundCapacity(capacity));
+    }
+  }
 
-    capacity_ = [&capacity]() {
-      size_t res = 4;
-      while (res < capacity) {
-        res *= kArrayResizeK;
-      }
-      return res;
-    }();
-    Reallocate();
+  void Resize(size_t size) {
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T();
+    }
+    Shrink(size);
+  }
+
+  void Resize(size_t size, const T &default_value) {
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T(default_value);
+    }
+    Shrink(size);
   }
 
   ~Vector() {
-    delete[] data_;
+    Shrink(0);
+    Deallocate(data_, capacity_);
     data_ = nullptr;
   }
 
   T &operator[](size_t n) {
+    Bounds::Check(n, size_);
+    return data_[n];
+  }
+
+  const T &operator[](size_t n) const {
+    Bounds::Check(n, size_);
+    return data_[n];
+  }
+
+  T &At(size_t n) {
     if (n >= size_) {
       throw std::range_error("");
     }
     return data_[n];
   }
 
-  const T &operator[](size_t n) const {
+  [[nodiscard]] const T &At(size_t n) const {
     if (n >= size_) {
       throw std::range_error("");
     }
@@ -102,20 +418,20 @@ public:
   }
 
   Vector &operator=(const Vector &x) {
-    if (this == *x)
+    if (this == &x)
       return *this;
 
-    Reserve(x.capacity_);
-    size_ = x.size_;
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = x.data_[i];
-    }
-
-    return *this;
+    Vector copy(x);
+    return *this = std::move(copy);
   }
 
   Vector &operator=(Vector &&x) noexcept {
-    delete[] data_;
+    if (this == &x)
+      return *this;
+
+    Shrink(0);
+    Deallocate(data_, capacity_);
+    alloc_ = x.alloc_;
     data_ = x.data_;
     x.data_ = nullptr;
     capacity_ = x.capacity_;
@@ -126,28 +442,469 @@ public:
   }
 
   [[nodiscard]] size_t Size() const noexcept { return size_; }
+  [[nodiscard]] size_t Capacity() const noexcept { return capacity_; }
+  T *Data() noexcept { return data_; }
+  const T *Data() const noexcept { return data_; }
+  [[nodiscard]] Allocator GetAllocator() const { return alloc_; }
 
 private:
-  void Reallocate() {
-    auto new_data = new T[capacity_];
-    for (size_t i(0); i < size_; ++i) {
-      new_data[i] = std::move(data_[i]);
+  T *Allocate(size_t capacity) {
+    T *data;
+    if constexpr (kUseRealloc) {
+      data = Realloc(nullptr, capacity);
+    } else {
+      data = AllocTraits::allocate(alloc_, capacity);
     }
-    delete[] data_;
+    memory::RecordAllocation(memory::AllocSite::kVector, capacity * sizeof(T));
+    return data;
+  }
+
+  void Deallocate(T *data, size_t capacity) noexcept {
+    if (data == nullptr) {
+      return;
+    }
+    memory::RecordDeallocation(memory::AllocSite::kVector,
+                               capacity * sizeof(T));
+    if constexpr (kUseRealloc) {
+      std::free(data);
+    } else {
+      AllocTraits::deallocate(alloc_, data, capacity);
+    }
+  }
+
+  static T *Realloc(T *data, size_t capacity) {
+    if (capacity > SIZE_MAX / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    void *new_data =
+        std::realloc(static_cast<void *>(data), capacity * sizeof(T));
+    if (new_data == nullptr && capacity != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(new_data);
+  }
+
+  static size_t RoundCapacity(size_t capacity) {
+    return Growth::Fit(capacity);
+  }
+
+  [[nodiscard]] size_t NextCapacity() const {
+    return Growth::Next(capacity_);
+  }
+
+  // Trivially relocatable elements are copied over as bytes. Others are moved
+  // when T's move can't throw (or T can't be copied) and copied otherwise, so
+  // a throwing relocation leaves the vector untouched.
+  void Relocate(T *new_data, size_t capacity) {
+    if constexpr (kRelocateBytes) {
+      if (size_ != 0) {
+        std::memcpy(static_cast<void *>(new_data), data_, size_ * sizeof(T));
+      }
+    } else {
+      size_t i(0);
+      try {
+        for (; i < size_; ++i) {
+          new (new_data + i) T(std::move_if_noexcept(data_[i]));
+        }
+      } catch (...) {
+        while (i > 0) {
+          new_data[--i].~T();
+        }
+        throw;
+      }
+      for (i = 0; i < size_; ++i) {
+        data_[i].~T();
+      }
+    }
+    if (data_ != nullptr) {
+      memory::RecordReallocation(memory::AllocSite::kVector);
+    }
+    Deallocate(data_, capacity_);
     data_ = new_data;
+    capacity_ = capacity;
+  }
+
+  void Reallocate(size_t capacity) {
+    if constexpr (kUseRealloc) {
+      T *new_data = Realloc(data_, capacity);
+      if (data_ != nullptr) {
+        memory::RecordReallocation(memory::AllocSite::kVector);
+        memory::RecordDeallocation(memory::AllocSite::kVector,
+                                   capacity_ * sizeof(T));
+      }
+      memory::RecordAllocation(memory::AllocSite::kVector,
+                               capacity * sizeof(T));
+      data_ = new_data;
+      capacity_ = capacity;
+    } else {
+      T *new_data = Allocate(capacity);
+      try {
+        Relocate(new_data, capacity);
+      } catch (...) {
+        Deallocate(new_data, capacity);
+        throw;
+      }
+    }
+  }
+
+  void Shrink(size_t size) noexcept {
+    while (size_ > size) {
+      data_[--size_].~T();
+    }
   }
 
   T *data_ = nullptr;
-  size_t size_;
-  size_t capacity_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  [[no_unique_address]] Allocator alloc_;
+};
+
+// The buffer pointer is all a Vector holds, so it can be relocated whenever
+// its allocator can.
+template <typename T, typename Alloc, typename Bounds, typename Growth>
+struct IsTriviallyRelocatable<Vector<T, Alloc, Bounds, Growth>>
+    : std::is_trivially_copyable<typename std::allocator_traits<
+          Alloc>::template rebind_alloc<T>> {};
+
+} // namespace tools::containers
+
+namespace tools::containers {
+
+// Values grouped by a bounded key, appended in O(1) with no histogram or
+// scatter pass. Every key owns a chain of chunks carved out of fixed-size
+// segments that are never moved or copied; chunk capacities double along a
+// chain, so rare keys waste little and frequent ones are read mostly
+// sequentially. ForEach visits keys in increasing order and the values of a
+// key in insertion order.
+template <typename T> class BucketChains {
+public:
+  explicit BucketChains(size_t keys)
+      : heads_(keys, kNoChunk), tails_(keys, kNoChunk) {}
+
+  [[nodiscard]] size_t Keys() const noexcept { return heads_.Size(); }
+
+  void PushBack(size_t key, const T &value) {
+    uint32_t tail = tails_[key];
+    if (tail == kNoChunk || chunks_[tail].size == chunks_[tail].capacity) {
+      tail = NewChunk(key, tail);
+    }
+    Chunk &chunk = chunks_[tail];
+    Item(chunk.begin + chunk.size++) = value;
+  }
+
+  template <typename Fn> void ForEach(Fn visit) const {
+    for (size_t key(0); key < heads_.Size(); ++key) {
+      for (uint32_t c = heads_[key]; c != kNoChunk; c = chunks_[c].next) {
+        const Chunk &chunk = chunks_[c];
+        for (uint32_t i(0); i < chunk.size; ++i) {
+          visit(key, Item(chunk.begin + i));
+        }
+      }
+    }
+  }
+
+private:
+  static constexpr const uint32_t kNoChunk = UINT32_MAX;
+
+  struct Chunk {
+    size_t begin;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t next;
+  };
+
+  uint32_t NewChunk(size_t key, uint32_t tail) {
+    const uint32_t capacity =
+        tail == kNoChunk
+            ? kBucketFirstChunk
+            : std::min(kBucketMaxChunk, 2 * chunks_[tail].capacity);
+    if ((items_ + capacity - 1) >> kBucketSegmentBits !=
+        items_ >> kBucketSegmentBits) {
+      items_ = ((items_ >> kBucketSegmentBits) + 1) << kBucketSegmentBits;
+    }
+    if ((items_ >> kBucketSegmentBits) == segments_.Size()) {
+      segments_.PushBack(std::make_shared<T[]>(kBucketSegmentSize));
+    }
+    const auto index = static_cast<uint32_t>(chunks_.Size());
+    chunks_.PushBack({items_, 0, capacity, kNoChunk});
+    items_ += capacity;
+    if (tail == kNoChunk) {
+      heads_[key] = index;
+    } else {
+      chunks_[tail].next = index;
+    }
+    tails_[key] = index;
+    return index;
+  }
+
+  T &Item(size_t i) const {
+    return segments_[i >> kBucketSegmentBits][i & (kBucketSegmentSize - 1)];
+  }
+
+  Vector<std::shared_ptr<T[]>> segments_;
+  size_t items_ = 0;
+  Vector<Chunk> chunks_;
+  Vector<uint32_t> heads_;
+  Vector<uint32_t> tails_;
 };
 
 } // namespace tools::containers
 
 namespace tools::containers::vector_tools {
 
+// Key extractors are taken by reference and called on const elements, so
+// they inline into the histogram and scatter loops and never copy a record.
+template <typename Fn, typename T>
+concept KeyExtractor = std::invocable<const Fn &, const T &> &&
+    std::convertible_to<std::invoke_result_t<const Fn &, const T &>, size_t>;
+
+struct KeyIndex {
+  size_t key;
+  uint32_t index;
+};
+
+struct KeyOfIndex {
+  size_t operator()(const KeyIndex &e) const { return e.key; }
+};
+
+// Counters of the sort passes. Every index into them is computed by the pass
+// itself, so they skip the bounds check.
 template <typename T>
-void LinearStableSort(Vector<T> &v, std::function<size_t(T)> GetVal) {
+using ScratchVector = Vector<T, std::allocator<T>, UncheckedAccess>;
+
+// Histograms of (key >> shift) & mask over n keys placed every `stride`
+// words. The plain loop serializes on store-to-load forwarding whenever
+// neighbouring keys repeat, so the kernels below spread the increments over
+// kSubHistograms interleaved counters per bucket and sum them afterwards.
+inline void HistogramNaive(const size_t *keys, size_t stride, size_t n,
+                           size_t shift, size_t mask, size_t *count) {
+  for (size_t i(0); i < n; ++i) {
+    ++count[(keys[i * stride] >> shift) & mask];
+  }
+}
+
+inline void MergeSubHistograms(const uint32_t *sub, size_t buckets,
+                               size_t *count) {
+  for (size_t d(0); d < buckets; ++d) {
+    const uint32_t *s = sub + d * kSubHistograms;
+    count[d] += size_t(s[0]) + s[1] + s[2] + s[3];
+  }
+}
+
+inline void HistogramScalar(const size_t *keys, size_t stride, size_t n,
+                            size_t shift, size_t mask, size_t *count,
+                            size_t buckets) {
+  Vector<uint32_t> sub_histograms(buckets * kSubHistograms, 0);
+  uint32_t *sub = sub_histograms.Data();
+  size_t i(0);
+  for (; i + kSubHistograms <= n; i += kSubHistograms) {
+    const size_t *k = keys + i * stride;
+    ++sub[((k[0] >> shift) & mask) * kSubHistograms];
+    ++sub[((k[stride] >> shift) & mask) * kSubHistograms + 1];
+    ++sub[((k[2 * stride] >> shift) & mask) * kSubHistograms + 2];
+    ++sub[((k[3 * stride] >> shift) & mask) * kSubHistograms + 3];
+  }
+  HistogramNaive(keys + i * stride, stride, n - i, shift, mask, count);
+  MergeSubHistograms(sub, buckets, count);
+}
+
+#ifdef __x86_64__
+// Same as HistogramScalar, but four keys are gathered, shifted and masked
+// in one AVX2 register per step.
+__attribute__((target("avx2"))) inline void
+HistogramAvx2(const size_t *keys, size_t stride, size_t n, size_t shift,
+              size_t mask, size_t *count, size_t buckets) {
+  Vector<uint32_t> sub_histograms(buckets * kSubHistograms, 0);
+  uint32_t *sub = sub_histograms.Data();
+  const auto s = static_cast<long long>(stride);
+  const __m256i offsets = _mm256_setr_epi64x(0, s, 2 * s, 3 * s);
+  const __m128i shift_v = _mm_cvtsi64_si128(static_cast<long long>(shift));
+  const __m256i mask_v = _mm256_set1_epi64x(static_cast<long long>(mask));
+  alignas(32) uint64_t d[kSubHistograms];
+  size_t i(0);
+  for (; i + kSubHistograms <= n; i += kSubHistograms) {
+    const size_t *p = keys + i * stride;
+    __m256i k;
+    if (stride == 2) {
+      // Key/payload pairs: two plain loads and an unpack beat a gather.
+      const __m256i lo =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      const __m256i hi =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 4));
+      k = _mm256_unpacklo_epi64(lo, hi);
+    } else {
+      k = _mm256_i64gather_epi64(reinterpret_cast<const long long *>(p),
+                                 offsets, 8);
+    }
+    k = _mm256_and_si256(_mm256_srl_epi64(k, shift_v), mask_v);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(d), k);
+    ++sub[d[0] * kSubHistograms];
+    ++sub[d[1] * kSubHistograms + 1];
+    ++sub[d[2] * kSubHistograms + 2];
+    ++sub[d[3] * kSubHistograms + 3];
+  }
+  HistogramNaive(keys + i * stride, stride, n - i, shift, mask, count);
+  MergeSubHistograms(sub, buckets, count);
+}
+#endif
+
+// Adds the histogram to count[0, buckets). Sub-histograms are used when they
+// stay cache-sized and their merge is cheap next to n increments. The AVX2
+// kernel is opt-in (AVX2_HISTOGRAM): spilling the lanes back to scalar
+// increments costs about what the vector load saves, see
+// lab-1/bench/histogram_bench.cpp.
+inline void Histogram(const size_t *keys, size_t stride, size_t n,
+                      size_t shift, size_t mask, size_t *count,
+                      size_t buckets) {
+  if (buckets > kSubHistogramMaxBuckets || buckets * kSubHistograms > n ||
+      n > UINT32_MAX) {
+    HistogramNaive(keys, stride, n, shift, mask, count);
+    return;
+  }
+#if defined(__x86_64__) && defined(AVX2_HISTOGRAM)
+  static const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+  if (kHasAvx2) {
+    HistogramAvx2(keys, stride, n, shift, mask, count, buckets);
+    return;
+  }
+#endif
+  HistogramScalar(keys, stride, n, shift, mask, count, buckets);
+}
+
+template <typename T, typename... P, typename Fn>
+void ChunkHistogram(const Vector<T, P...> &v, size_t begin, size_t end,
+                    const Fn &GetVal, size_t shift, size_t mask,
+                    size_t *count, size_t) {
+  for (size_t i(begin); i < end; ++i) {
+    ++count[(GetVal(v[i]) >> shift) & mask];
+  }
+}
+
+// Keys of KeyIndex entries are contiguous with a fixed stride, which is what
+// the vectorized kernel needs.
+template <typename... P>
+void ChunkHistogram(const Vector<KeyIndex, P...> &v, size_t begin, size_t end,
+                    const KeyOfIndex &, size_t shift, size_t mask,
+                    size_t *count, size_t buckets) {
+  static_assert(sizeof(KeyIndex) % sizeof(size_t) == 0);
+  constexpr const size_t kStride = sizeof(KeyIndex) / sizeof(size_t);
+  Histogram(&v.Data()[begin].key, kStride, end - begin, shift, mask, count,
+            buckets);
+}
+
+template <typename Fn> void RunChunks(size_t threads, Fn Work) {
+  if (threads < 2) {
+    Work(0);
+    return;
+  }
+  Vector<std::thread> pool(threads - 1);
+  for (size_t t(1); t < threads; ++t) {
+    pool[t - 1] = std::thread(Work, t);
+  }
+  Work(0);
+  for (size_t t(0); t + 1 < threads; ++t) {
+    pool[t].join();
+  }
+}
+
+// Threads a pass over n elements actually runs on: chunks smaller than
+// kParallelMinChunk are not worth a thread of their own.
+inline size_t PassThreads(size_t n, size_t threads) {
+  return std::max<size_t>(1, std::min(threads, n / kParallelMinChunk));
+}
+
+// Stable scatter of v into res by the digit (GetVal(v[i]) >> shift) & mask in
+// [0, buckets). Every thread builds a histogram of its own contiguous chunk,
+// the histograms are merged bucket-major into per-thread write offsets and
+// every thread then scatters its chunk, so the result does not depend on the
+// thread count. Returns false without touching res when all elements share
+// one digit.
+template <typename T, typename... P, typename Fn>
+bool ScatterPass(Vector<T, P...> &v, Vector<T, P...> &res, const Fn &GetVal,
+                 size_t shift, size_t mask, size_t buckets, size_t threads) {
+  const auto Digit = [&GetVal, shift, mask](const T &e) {
+    return (GetVal(e) >> shift) & mask;
+  };
+  const size_t n = v.Size();
+  threads = PassThreads(n, threads);
+  const size_t chunk = (n + threads - 1) / threads;
+  ScratchVector<size_t> count(threads * buckets, 0);
+
+  RunChunks(threads, [&](size_t t) {
+    const size_t begin = std::min(n, t * chunk);
+    const size_t end = std::min(n, (t + 1) * chunk);
+    ChunkHistogram(v, begin, end, GetVal, shift, mask,
+                   count.Data() + t * buckets, buckets);
+  });
+
+  const size_t first = Digit(v[0]);
+  size_t first_total = 0;
+  for (size_t t(0); t < threads; ++t) {
+    first_total += count[t * buckets + first];
+  }
+  if (first_total == n) {
+    return false;
+  }
+
+  size_t sum = 0;
+  for (size_t d(0); d < buckets; ++d) {
+    for (size_t t(0); t < threads; ++t) {
+      const size_t c = count[t * buckets + d];
+      count[t * buckets + d] = sum;
+      sum += c;
+    }
+  }
+
+  RunChunks(threads, [&](size_t t) {
+    const size_t base = t * buckets;
+    const size_t end = std::min(n, (t + 1) * chunk);
+    for (size_t i(t * chunk); i < end; ++i) {
+      res[count[base + Digit(v[i])]++] = std::move(v[i]);
+    }
+  });
+  return true;
+}
+
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void CountingStableSort(Vector<T, P...> &v, const Fn &GetVal, size_t max_val,
+                        size_t threads = 1) {
+  Vector<T, P...> res(v.Size());
+  if (ScatterPass(v, res, GetVal, 0, SIZE_MAX, max_val + 1, threads)) {
+    v = std::move(res);
+  }
+}
+
+// LSD radix sort over kRadixDigitBits-wide digits, memory is O(n + 2^digit)
+// whatever max_val is. Passes where every key has the same digit are skipped.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void RadixStableSort(Vector<T, P...> &v, const Fn &GetVal, size_t max_val,
+                     size_t threads = 1) {
+  Vector<T, P...> buf(v.Size());
+
+  for (size_t shift(0); shift < 64 && (max_val >> shift) != 0;
+       shift += kRadixDigitBits) {
+    if (ScatterPass(v, buf, GetVal, shift, kRadixDigitMask, kRadixDigitSize,
+                    threads)) {
+      std::swap(v, buf);
+    }
+  }
+}
+
+// Whether counting sort keeps its histograms within kCountingRangeFactor
+// times what radix passes need. Every thread of the pass holds its own
+// max_val + 1 counters, so the limit is threads * (max_val + 1) against
+// n + threads * 2^digit.
+inline bool UseCountingSort(size_t n, size_t max_val, size_t threads) {
+  threads = PassThreads(n, threads);
+  return max_val / kCountingRangeFactor < n / threads + kRadixDigitSize;
+}
+
+// Picks counting sort while UseCountingSort allows it, otherwise falls back
+// to LSD radix passes. With threads > 1 every pass is split over contiguous
+// chunks; the output is the same as the serial one.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void LinearStableSort(Vector<T, P...> &v, const Fn &GetVal,
+                      size_t threads = 1) {
   if (v.Size() < 2) {
     return;
   }
@@ -157,38 +914,723 @@ void LinearStableSort(Vector<T> &v, std::function<size_t(T)> GetVal) {
     max_val = std::max(max_val, GetVal(v[i]));
   }
 
-  Vector<int> count(max_val + 1, 0);
+  if (UseCountingSort(v.Size(), max_val, threads)) {
+    CountingStableSort(v, GetVal, max_val, threads);
+  } else {
+    RadixStableSort(v, GetVal, max_val, threads);
+  }
+}
+
+// Stable order of v by GetVal as compact (key, index) entries, the records
+// themselves are not moved.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+Vector<KeyIndex> SortedKeyIndex(const Vector<T, P...> &v, const Fn &GetVal,
+                                size_t threads = 1) {
+  if (v.Size() > UINT32_MAX) {
+    throw std::length_error("Too many elements for 32-bit indices");
+  }
+  Vector<KeyIndex> order(v.Size());
+  KeyIndex *entries = order.Data();
   for (size_t i(0); i < v.Size(); ++i) {
-    ++count[GetVal(v[i])];
+    entries[i] = {GetVal(v[i]), static_cast<uint32_t>(i)};
+  }
+  LinearStableSort(order, KeyOfIndex(), threads);
+  return order;
+}
+
+// Permutes v in place by following the cycles of order, one element at a
+// time, so there is no second array of T. The indices in order are consumed.
+template <typename T, typename... P, typename... Q>
+void ApplyOrder(Vector<T, P...> &v, Vector<KeyIndex, Q...> &order) {
+  for (size_t i(0); i < order.Size(); ++i) {
+    if (order[i].index == i) {
+      continue;
+    }
+    T tmp = std::move(v[i]);
+    size_t dst = i;
+    size_t src = order[i].index;
+    while (src != i) {
+      v[dst] = std::move(v[src]);
+      order[dst].index = dst;
+      dst = src;
+      src = order[src].index;
+    }
+    v[dst] = std::move(tmp);
+    order[dst].index = dst;
+  }
+}
+
+} // namespace tools::containers::vector_tools
+
+namespace tools::io {
+
+// The whole input as one contiguous read-only buffer. Regular files
+// (including a redirected stdin) are mmap-ed, anything else is slurped in
+// large blocks. An empty path or "-" means stdin.
+class InputBuffer {
+public:
+  explicit InputBuffer(const std::string &path = "") {
+    const bool is_stdin = path.empty() || path == "-";
+    const int fd = is_stdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Can't open " + path);
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      const off_t offset = is_stdin ? lseek(fd, 0, SEEK_CUR) : 0;
+      if (offset >= 0 && offset < st.st_size) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+          madvise(map, st.st_size, MADV_SEQUENTIAL);
+          map_ = static_cast<char *>(map);
+          map_size_ = st.st_size;
+          data_ = map_ + offset;
+          size_ = map_size_ - offset;
+        }
+      }
+    }
+    if (!map_) {
+      Slurp(fd);
+    }
+    if (!is_stdin) {
+      close(fd);
+    }
   }
 
-  for (size_t i(1); i < count.Size(); ++i) {
-    count[i] += count[i - 1];
+  InputBuffer(const InputBuffer &) = delete;
+  InputBuffer &operator=(const InputBuffer &) = delete;
+
+  ~InputBuffer() {
+    if (map_) {
+      munmap(map_, map_size_);
+    } else {
+      free(data_);
+    }
   }
 
-  Vector<T> res(v.Size());
+  [[nodiscard]] const char *Data() const noexcept { return data_; }
+  [[nodiscard]] size_t Size() const noexcept { return size_; }
 
-  for (int64_t i = v.Size() - 1; i >= 0; --i) {
-    res[--count[GetVal(v[i])]] = std::move(v[i]);
+private:
+  void Slurp(int fd) {
+    size_t capacity = 0;
+    while (true) {
+      if (size_ == capacity) {
+        capacity = capacity ? capacity * 2 : kInputBlockSize;
+        char *grown = static_cast<char *>(realloc(data_, capacity));
+        if (!grown) {
+          free(data_);
+          throw std::bad_alloc();
+        }
+        data_ = grown;
+      }
+      const ssize_t got = read(fd, data_ + size_, capacity - size_);
+      if (got < 0) {
+        free(data_);
+        throw std::runtime_error("Can't read input");
+      }
+      if (got == 0) {
+        return;
+      }
+      size_ += got;
+    }
   }
 
-  v = std::move(res);
+  char *map_ = nullptr;
+  size_t map_size_ = 0;
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+inline bool IsSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-} // namespace tools::containers::vector_tools
+// Extracts "key value" records from a buffer the way
+// `std::cin >> key >> value` would: tokens are separated by any whitespace,
+// the key is an unsigned decimal number, the value is a view into the buffer.
+class RecordParser {
+public:
+  RecordParser(const char *data, size_t size)
+      : pos_(data), end_(data + size) {}
+
+  bool Next(size_t &key, std::string_view &value) {
+    SkipSpaces();
+    const char *digits = pos_;
+    key = 0;
+    while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9') {
+      const size_t digit = *pos_ - '0';
+      if (key > (SIZE_MAX - digit) / 10) {
+        return false;
+      }
+      key = key * 10 + digit;
+      ++pos_;
+    }
+    if (pos_ == digits) {
+      return false;
+    }
+
+    SkipSpaces();
+    const char *begin = pos_;
+    while (pos_ != end_ && !IsSpace(*pos_)) {
+      ++pos_;
+    }
+    value = std::string_view(begin, pos_ - begin);
+    return !value.empty();
+  }
+
+private:
+  void SkipSpaces() {
+    while (pos_ != end_ && IsSpace(*pos_)) {
+      ++pos_;
+    }
+  }
+
+  const char *pos_;
+  const char *end_;
+};
+
+} // namespace tools::io
+
+namespace tools::io {
+
+namespace {
+
+struct DigitPairs {
+  char data[200];
+
+  constexpr DigitPairs() : data() {
+    for (int i(0); i < 100; ++i) {
+      data[2 * i] = static_cast<char>('0' + i / 10);
+      data[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+  }
+};
+
+constexpr const DigitPairs kDigitPairs;
+
+} // namespace
+
+// Buffered writer straight to a file descriptor. Payloads that don't fit in
+// the free part of the buffer go out together with it in one writev.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(int fd = STDOUT_FILENO,
+                        size_t capacity = kOutputBufferSize)
+      : fd_(fd), capacity_(capacity) {
+    data_ = static_cast<char *>(malloc(capacity_));
+    if (!data_) {
+      throw std::bad_alloc();
+    }
+  }
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  ~OutputBuffer() {
+    try {
+      Flush();
+    } catch (const std::runtime_error &) {
+    }
+    free(data_);
+  }
+
+  void Put(char c) {
+    if (size_ == capacity_) {
+      Flush();
+    }
+    data_[size_++] = c;
+  }
+
+  void Write(std::string_view s) {
+    if (s.size() <= capacity_ - size_) {
+      memcpy(data_ + size_, s.data(), s.size());
+      size_ += s.size();
+      return;
+    }
+    iovec iov[2] = {{data_, size_},
+                    {const_cast<char *>(s.data()), s.size()}};
+    WriteAll(iov, 2);
+    size_ = 0;
+  }
+
+  // Same bytes as `os << std::setw(width) << std::setfill('0') << value`.
+  void WriteZeroPadded(size_t value, size_t width) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (value >= 100) {
+      p -= 2;
+      memcpy(p, kDigitPairs.data + 2 * (value % 100), 2);
+      value /= 100;
+    }
+    if (value >= 10) {
+      p -= 2;
+      memcpy(p, kDigitPairs.data + 2 * value, 2);
+    } else {
+      *--p = static_cast<char>('0' + value);
+    }
+
+    const size_t len = digits + sizeof(digits) - p;
+    const size_t pad = width > len ? width - len : 0;
+    if (pad + len > capacity_ - size_) {
+      Flush();
+    }
+    memset(data_ + size_, '0', pad);
+    memcpy(data_ + size_ + pad, p, len);
+    size_ += pad + len;
+  }
+
+  void Flush() {
+    iovec iov = {data_, size_};
+    WriteAll(&iov, 1);
+    size_ = 0;
+  }
+
+private:
+  void WriteAll(iovec *iov, int count) {
+    while (count > 0) {
+      const ssize_t done = writev(fd_, iov, count);
+      if (done < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Can't write output");
+      }
+      size_t rest = done;
+      while (count > 0 && rest >= iov->iov_len) {
+        rest -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if (count > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + rest;
+        iov->iov_len -= rest;
+      }
+    }
+  }
+
+  int fd_;
+  char *data_;
+  size_t size_ = 0;
+  size_t capacity_;
+};
+
+} // namespace tools::io
 
 namespace tc = tools::containers;
+namespace tio = tools::io;
 namespace vt = tools::containers::vector_tools;
 
+// Records are only indexed by the sort passes and the print loops, so they
+// skip the bounds check, and grow by 1.5x so a large input overshoots its
+// final size by less.
+template <typename T>
+using RecordVector = tc::Vector<T, std::allocator<T>, tc::UncheckedAccess,
+                                tc::GeometricGrowth<3, 2>>;
+
 template <typename Tf, typename Ts>
 std::istream &operator>>(std::istream &is, std::pair<Tf, Ts> &p) {
   is >> p.first >> p.second;
   return is;
 }
 
-using TV = std::pair<size_t, std::string>;
+enum class SortMode { kMove, kIndex, kBucket, kExternal };
+enum class ReaderMode { kStream, kBuffer };
 
-int main() {
+struct Options {
+  size_t threads = 1;
+  SortMode mode = SortMode::kIndex;
+  ReaderMode reader = ReaderMode::kBuffer;
+  std::string input;
+  size_t budget = kExternalDefaultBudget;
+};
+
+// Reads a decimal count in [min, max] for option arg. std::stoul would take
+// "-1" as a huge value and throw out_of_range past 2^64, so the text is
+// checked first and every bad value is reported as a usage error.
+size_t ParseCount(const std::string &arg, const std::string &value, size_t min,
+                  size_t max) {
+  if (value.empty() ||
+      !std::all_of(value.begin(), value.end(),
+                   [](unsigned char c) { return std::isdigit(c); })) {
+    throw std::invalid_argument("Expected a number for " + arg + ": " + value);
+  }
+  // 19 digits always fit in 64 bits.
+  const size_t count = value.size() > 19 ? SIZE_MAX : std::stoull(value);
+  if (count < min || count > max) {
+    throw std::invalid_argument("Value of " + arg + " must be in [" +
+                                std::to_string(min) + ", " +
+                                std::to_string(max) + "]: " + value);
+  }
+  return count;
+}
+
+// lab-1 [-t|--threads N] [-m|--mode move|index|bucket|external]
+//       [-r|--reader stream|buffer] [-i|--input PATH] [-b|--budget MiB]
+// N = 0 means one thread per hardware core. "move" sorts the records
+// themselves, "index" sorts (key, index) entries and prints through them,
+// "bucket" appends records into per-key chains while reading (keys of
+// kBucketKeys and above are sorted separately and printed last),
+// "external" spills sorted runs of about --budget MiB to temp files (in
+// $TMPDIR or /tmp) and merges them; it always reads with the stream reader.
+// "stream" reads records with operator>>, "buffer" maps (or slurps) the whole
+// input and keeps the values as views into it. Without PATH stdin is read.
+Options ParseOptions(int argc, char *argv[]) {
+  Options options;
+  for (int i(1); i < argc; ++i) {
+    const std::string arg = argv[i];
+    if ((arg == "-t" || arg == "--threads") && i + 1 < argc) {
+      options.threads = ParseCount(arg, argv[++i], 0, kMaxThreads);
+    } else if ((arg == "-m" || arg == "--mode") && i + 1 < argc) {
+      const std::string mode = argv[++i];
+      if (mode == "move") {
+        options.mode = SortMode::kMove;
+      } else if (mode == "index") {
+        options.mode = SortMode::kIndex;
+      } else if (mode == "bucket") {
+        options.mode = SortMode::kBucket;
+      } else if (mode == "external") {
+        options.mode = SortMode::kExternal;
+      } else {
+        throw std::invalid_argument("Unknown mode: " + mode);
+      }
+    } else if ((arg == "-r" || arg == "--reader") && i + 1 < argc) {
+      const std::string reader = argv[++i];
+      if (reader == "stream") {
+        options.reader = ReaderMode::kStream;
+      } else if (reader == "buffer") {
+        options.reader = ReaderMode::kBuffer;
+      } else {
+        throw std::invalid_argument("Unknown reader: " + reader);
+      }
+    } else if ((arg == "-i" || arg == "--input") && i + 1 < argc) {
+      options.input = argv[++i];
+    } else if ((arg == "-b" || arg == "--budget") && i + 1 < argc) {
+      options.budget = ParseCount(arg, argv[++i], 1, kMaxBudgetMiB) << 20;
+    } else {
+      throw std::invalid_argument("Unknown option: " + arg);
+    }
+  }
+  if (options.threads == 0) {
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  return options;
+}
+
+void WriteRecord(tio::OutputBuffer &out, size_t key, std::string_view value) {
+  out.WriteZeroPadded(key, 6);
+  out.Put('\t');
+  out.Write(value);
+  out.Put('\n');
+}
+
+template <typename TV>
+void SortAndPrint(RecordVector<TV> &v, const Options &options) {
+  tio::OutputBuffer out;
+  if (options.mode == SortMode::kIndex) {
+    const auto order = vt::SortedKeyIndex<TV>(
+        v, [](const TV &p) { return p.first; }, options.threads);
+    for (size_t i(0); i < order.Size(); ++i) {
+      WriteRecord(out, order[i].key, v[order[i].index].second);
+    }
+  } else {
+    vt::LinearStableSort<TV>(
+        v, [](const TV &p) { return p.first; }, options.threads);
+    for (size_t i(0); i < v.Size(); ++i) {
+      WriteRecord(out, v[i].first, v[i].second);
+    }
+  }
+  out.Flush();
+}
+
+template <typename TV, typename Next>
+void BucketSortAndPrint(Next next, const Options &options) {
+  using Value = typename TV::second_type;
+  tc::BucketChains<Value> buckets(kBucketKeys);
+  RecordVector<TV> overflow;
+  TV tmp;
+  while (next(tmp)) {
+    if (tmp.first < buckets.Keys()) {
+      buckets.PushBack(tmp.first, tmp.second);
+    } else {
+      overflow.PushBack(tmp);
+    }
+  }
+
+  tio::OutputBuffer out;
+  buckets.ForEach([&out](size_t key, const Value &value) {
+    WriteRecord(out, key, value);
+  });
+  const auto order = vt::SortedKeyIndex<TV>(
+      overflow, [](const TV &p) { return p.first; }, options.threads);
+  for (size_t i(0); i < order.Size(); ++i) {
+    WriteRecord(out, order[i].key, overflow[order[i].index].second);
+  }
+  out.Flush();
+}
+
+template <typename TV, typename Next>
+void Ingest(Next next, const Options &options) {
+  if (options.mode == SortMode::kBucket) {
+    BucketSortAndPrint<TV>(next, options);
+    return;
+  }
+  RecordVector<TV> v;
+  v.Reserve(kArrayInitSize);
+  TV tmp;
+  while (next(tmp)) {
+    v.PushBack(tmp);
+  }
+  SortAndPrint(v, options);
+}
+
+void RunStream(std::istream &is, const Options &options) {
+  using TV = std::pair<size_t, std::string>;
+  Ingest<TV>([&is](TV &p) { return static_cast<bool>(is >> p); }, options);
+}
+
+void RunBuffer(const Options &options) {
+  using TV = std::pair<size_t, std::string_view>;
+  const tio::InputBuffer input(options.input);
+  tio::RecordParser parser(input.Data(), input.Size());
+  Ingest<TV>([&parser](TV &p) { return parser.Next(p.first, p.second); },
+             options);
+}
+
+// Runs live in unlinked temp files: every record is its key and value size
+// as two raw size_t followed by the value bytes.
+int OpenRunFile() {
+  const char *dir = getenv("TMPDIR");
+  std::string path = std::string(dir && *dir ? dir : "/tmp") + "/lab-1.XXXXXX";
+  const int fd = mkstemp(path.data());
+  if (fd < 0) {
+    throw std::runtime_error("Can't create temp file in " + path);
+  }
+  unlink(path.c_str());
+  return fd;
+}
+
+void WriteRunRecord(tio::OutputBuffer &out, size_t key,
+                    std::string_view value) {
+  const size_t header[2] = {key, value.size()};
+  out.Write(std::string_view(reinterpret_cast<const char *>(header),
+                             sizeof(header)));
+  out.Write(value);
+}
+
+void RewindRunFile(int fd) {
+  if (lseek(fd, 0, SEEK_SET) != 0) {
+    throw std::runtime_error("Can't rewind temp file");
+  }
+}
+
+int SpillRun(RecordVector<std::pair<size_t, std::string>> &v,
+             const Options &options) {
+  using TV = std::pair<size_t, std::string>;
+  const auto order = vt::SortedKeyIndex<TV>(
+      v, [](const TV &p) { return p.first; }, options.threads);
+  const int fd = OpenRunFile();
+  tio::OutputBuffer out(fd, kRunMinBlockSize);
+  for (size_t i(0); i < order.Size(); ++i) {
+    WriteRunRecord(out, order[i].key, v[order[i].index].second);
+  }
+  out.Flush();
+  RewindRunFile(fd);
+  return fd;
+}
+
+class RunReader {
+public:
+  RunReader(int fd, size_t block)
+      : fd_(fd), block_(block), data_(new char[block]) {}
+
+  RunReader(const RunReader &) = delete;
+  RunReader &operator=(const RunReader &) = delete;
+
+  ~RunReader() {
+    delete[] data_;
+    close(fd_);
+  }
+
+  bool Next() {
+    size_t header[2];
+    if (!Read(reinterpret_cast<char *>(header), sizeof(header))) {
+      return false;
+    }
+    key_ = header[0];
+    value_.resize(header[1]);
+    if (!Read(value_.data(), value_.size())) {
+      throw std::runtime_error("Truncated run file");
+    }
+    return true;
+  }
+
+  [[nodiscard]] size_t Key() const { return key_; }
+  [[nodiscard]] const std::string &Value() const { return value_; }
+
+private:
+  bool Read(char *dst, size_t n) {
+    while (n > 0) {
+      if (pos_ == size_) {
+        const ssize_t got = read(fd_, data_, block_);
+        if (got < 0) {
+          throw std::runtime_error("Can't read run file");
+        }
+        if (got == 0) {
+          return false;
+        }
+        pos_ = 0;
+        size_ = got;
+      }
+      const size_t part = std::min(n, size_ - pos_);
+      memcpy(dst, data_ + pos_, part);
+      pos_ += part;
+      dst += part;
+      n -= part;
+    }
+    return true;
+  }
+
+  int fd_;
+  size_t block_;
+  char *data_;
+  size_t pos_ = 0;
+  size_t size_ = 0;
+  size_t key_ = 0;
+  std::string value_;
+};
+
+// Runs merged at once. Every reader and the output buffer get an equal
+// block of the budget, and no block is smaller than kRunMinBlockSize.
+size_t MergeFanIn(size_t budget) {
+  return std::clamp<size_t>(budget / kRunMinBlockSize - 1, 2, kMaxOpenRuns);
+}
+
+// Runs are generated in input order, so breaking key ties by run number
+// keeps the merge stable and the output equal to the in-memory sort.
+// Takes ownership of the run files.
+template <typename Emit>
+void MergeRuns(const tc::Vector<int> &runs, size_t block, Emit emit) {
+  tc::Vector<std::unique_ptr<RunReader>> readers(runs.Size());
+  using Head = std::pair<size_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<>> heads;
+  for (size_t r(0); r < runs.Size(); ++r) {
+    readers[r] = std::make_unique<RunReader>(runs[r], block);
+    if (readers[r]->Next()) {
+      heads.emplace(readers[r]->Key(), r);
+    }
+  }
+
+  while (!heads.empty()) {
+    const size_t r = heads.top().second;
+    heads.pop();
+    emit(readers[r]->Key(), readers[r]->Value());
+    if (readers[r]->Next()) {
+      heads.emplace(readers[r]->Key(), r);
+    }
+  }
+}
+
+// Merges runs[first, runs.Size()) into one run that takes their place.
+void MergeTail(tc::Vector<int> &runs, size_t first, size_t budget) {
+  tc::Vector<int> tail;
+  for (size_t r(first); r < runs.Size(); ++r) {
+    tail.PushBack(runs[r]);
+  }
+  const size_t block = budget / (tail.Size() + 1);
+  const int merged = OpenRunFile();
+  {
+    tio::OutputBuffer out(merged, std::min(block, kOutputBufferSize));
+    MergeRuns(tail, block, [&out](size_t key, std::string_view value) {
+      WriteRunRecord(out, key, value);
+    });
+    out.Flush();
+  }
+  RewindRunFile(merged);
+  runs.Resize(first);
+  runs.PushBack(merged);
+}
+
+// Pending runs by level: level 0 takes the spilled runs and a full level is
+// merged into one run of the next. A level only holds runs newer than the
+// level above it, so every merge is of consecutive runs and stays stable,
+// and a record is rewritten about log(runs) / log(fan-in) times in all.
+void AddRun(tc::Vector<tc::Vector<int>> &levels, int fd,
+            const Options &options) {
+  const size_t fan_in = MergeFanIn(options.budget);
+  for (size_t l(0);; ++l) {
+    if (l == levels.Size()) {
+      levels.EmplaceBack();
+    }
+    levels[l].PushBack(fd);
+    if (levels[l].Size() < fan_in) {
+      return;
+    }
+    MergeTail(levels[l], 0, options.budget);
+    fd = levels[l][0];
+    levels[l] = tc::Vector<int>();
+  }
+}
+
+// Memory taken by the records of a run before it is spilled: all of v's
+// buffer, the values, and the two KeyIndex arrays SortedKeyIndex sorts
+// through.
+size_t RunBytes(const RecordVector<std::pair<size_t, std::string>> &v,
+                size_t value_bytes) {
+  return v.Capacity() * sizeof(v[0]) + value_bytes +
+         v.Size() * 2 * sizeof(vt::KeyIndex);
+}
+
+void RunExternal(std::istream &is, const Options &options) {
+  using TV = std::pair<size_t, std::string>;
+  tc::Vector<tc::Vector<int>> levels;
+  RecordVector<TV> v;
+  size_t value_bytes = 0;
+  TV tmp;
+  while (is >> tmp) {
+    v.PushBack(tmp);
+    value_bytes += v[v.Size() - 1].second.capacity();
+    if (RunBytes(v, value_bytes) >= options.budget) {
+      AddRun(levels, SpillRun(v, options), options);
+      v = RecordVector<TV>();
+      value_bytes = 0;
+    }
+  }
+  if (levels.Size() == 0) {
+    SortAndPrint(v, options);
+    return;
+  }
+
+  // Oldest runs first, then cut down to a single merge from the newest end,
+  // where the runs are smallest.
+  tc::Vector<int> runs;
+  for (size_t l(levels.Size()); l-- > 0;) {
+    for (size_t r(0); r < levels[l].Size(); ++r) {
+      runs.PushBack(levels[l][r]);
+    }
+  }
+  levels = tc::Vector<tc::Vector<int>>();
+  if (v.Size() != 0) {
+    runs.PushBack(SpillRun(v, options));
+  }
+  v = RecordVector<TV>();
+  const size_t fan_in = MergeFanIn(options.budget);
+  while (runs.Size() > fan_in) {
+    const size_t excess = runs.Size() - fan_in + 1;
+    MergeTail(runs, runs.Size() - std::min(excess, fan_in), options.budget);
+  }
+
+  const size_t block = options.budget / (runs.Size() + 1);
+  tio::OutputBuffer out(STDOUT_FILENO, std::min(block, kOutputBufferSize));
+  MergeRuns(runs, block, [&out](size_t key, std::string_view value) {
+    WriteRecord(out, key, value);
+  });
+  out.Flush();
+}
+
+int main(int argc, char *argv[]) {
+  tools::memory::DumpAllocStatsAtExit();
 
 #define QUICK_IO
 
@@ -197,16 +1639,36 @@ int main() {
   std::cin.tie(nullptr);
 #endif
 
-  tc::Vector<TV> v;
-  v.Reserve(kArrayInitSize);
-  TV tmp;
-  while (std::cin >> tmp) {
-    v.PushBack(tmp);
+  Options options;
+  try {
+    options = ParseOptions(argc, argv);
+  } catch (const std::logic_error &ex) {
+    std::cerr << ex.what() << '\n';
+    return 1;
   }
-  vt::LinearStableSort<TV>(v, [](const TV &p) { return p.first; });
-  for (size_t i(0); i < v.Size(); ++i) {
-    std::cout << std::setw(6) << std::setfill('0') << v[i].first << '\t'
-              << v[i].second << '\n';
+
+  try {
+    if (options.reader == ReaderMode::kBuffer &&
+        options.mode != SortMode::kExternal) {
+      RunBuffer(options);
+      return 0;
+    }
+    std::ifstream fin;
+    if (!options.input.empty()) {
+      fin.open(options.input);
+      if (!fin) {
+        throw std::runtime_error("Can't open " + options.input);
+      }
+    }
+    std::istream &is = options.input.empty() ? std::cin : fin;
+    if (options.mode == SortMode::kExternal) {
+      RunExternal(is, options);
+    } else {
+      RunStream(is, options);
+    }
+  } catch (const std::runtime_error &ex) {
+    std::cerr << ex.what() << '\n';
+    return 1;
   }
   return 0;
-}
\ No newline at end of file
+}
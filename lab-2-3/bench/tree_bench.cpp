@@ -0,0 +1,178 @@
+// AVLTree against BTree on the operations Dict performs, at growing sizes.
+// Prints CSV: keys,phase,impl,seconds,ns_per_op
+//
+// lab-2-3-tree-bench [-n KEYS]... [-s SEED] [-r REPEATS]
+//
+// Without -n it runs 10^4, 10^6 and 10^8 keys. Keys and values are 64-bit;
+// at 10^8 keys the AVLTree alone needs about 5 GB.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "containers/avl_tree.hpp"
+#include "containers/btree.hpp"
+
+namespace tc = tools::containers;
+
+namespace {
+
+// Lookups are sampled so the largest sizes finish in reasonable time.
+constexpr const size_t kMaxQueries = 10'000'000;
+
+struct Config {
+  std::vector<size_t> sizes;
+  uint64_t seed = 1;
+  int repeats = 3;
+};
+
+struct Timings {
+  double insert = 1e100;
+  double hit = 1e100;
+  double miss = 1e100;
+  double iterate = 1e100;
+  double remove = 1e100;
+  uint64_t checksum = 0;
+};
+
+template <typename Fn> double Seconds(Fn run) {
+  const auto start = std::chrono::steady_clock::now();
+  run();
+  const auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(stop - start).count();
+}
+
+void Report(size_t n, const char *phase, const char *impl, double seconds,
+            size_t ops) {
+  std::cout << n << ',' << phase << ',' << impl << ',' << seconds << ','
+            << seconds * 1e9 / static_cast<double>(ops) << '\n';
+}
+
+void Check(bool ok, const std::string &what) {
+  if (!ok) {
+    throw std::runtime_error("Result mismatch: " + what);
+  }
+}
+
+// keys are distinct and in random order; odd keys are never inserted, so
+// they serve as misses.
+template <typename Tree>
+Timings Run(const std::vector<uint64_t> &keys,
+            const std::vector<uint64_t> &hits,
+            const std::vector<uint64_t> &misses, int repeats) {
+  Timings best;
+  for (int r(0); r < repeats; ++r) {
+    Tree tree;
+    uint64_t checksum = 0;
+    best.insert = std::min(best.insert, Seconds([&] {
+      for (size_t i(0); i < keys.size(); ++i) {
+        tree.TryEmplace(keys[i], i);
+      }
+    }));
+    Check(tree.Size() == keys.size(), "size after insert");
+    best.hit = std::min(best.hit, Seconds([&] {
+      for (uint64_t key : hits) {
+        checksum += tree.Find(key)()->value;
+      }
+    }));
+    best.miss = std::min(best.miss, Seconds([&] {
+      for (uint64_t key : misses) {
+        checksum += tree.Find(key)() != nullptr;
+      }
+    }));
+    best.iterate = std::min(best.iterate, Seconds([&] {
+      auto it = tree.Begin();
+      for (; it(); it.next()) {
+        checksum += it()->key;
+      }
+    }));
+    best.remove = std::min(best.remove, Seconds([&] {
+      for (uint64_t key : keys) {
+        tree.Remove(key);
+      }
+    }));
+    Check(tree.Size() == 0, "size after remove");
+    best.checksum = checksum;
+  }
+  return best;
+}
+
+void Report(size_t n, const char *impl, const Timings &t, size_t queries) {
+  Report(n, "insert", impl, t.insert, n);
+  Report(n, "find-hit", impl, t.hit, queries);
+  Report(n, "find-miss", impl, t.miss, queries);
+  Report(n, "iterate", impl, t.iterate, n);
+  Report(n, "remove", impl, t.remove, n);
+}
+
+void Run(size_t n, const Config &config, std::mt19937_64 &rng) {
+  std::vector<uint64_t> keys(n);
+  for (size_t i(0); i < n; ++i) {
+    keys[i] = 2 * i;
+  }
+  std::shuffle(keys.begin(), keys.end(), rng);
+  const size_t queries = std::min(n, kMaxQueries);
+  std::vector<uint64_t> hits(queries);
+  std::vector<uint64_t> misses(queries);
+  std::uniform_int_distribution<size_t> pick(0, n - 1);
+  for (size_t i(0); i < queries; ++i) {
+    hits[i] = keys[pick(rng)];
+    misses[i] = 2 * pick(rng) + 1;
+  }
+
+  const Timings avl =
+      Run<tc::AVLTree<uint64_t, uint64_t>>(keys, hits, misses, config.repeats);
+  Report(n, "AVLTree", avl, queries);
+  const Timings btree =
+      Run<tc::BTree<uint64_t, uint64_t>>(keys, hits, misses, config.repeats);
+  Report(n, "BTree", btree, queries);
+  Check(avl.checksum == btree.checksum, "checksum");
+}
+
+Config ParseConfig(int argc, char *argv[]) {
+  Config config;
+  for (int i(1); i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      throw std::invalid_argument("Missing value for " + arg);
+    }
+    if (arg == "-n") {
+      config.sizes.push_back(std::stoul(argv[++i]));
+    } else if (arg == "-s") {
+      config.seed = std::stoull(argv[++i]);
+    } else if (arg == "-r") {
+      config.repeats = std::stoi(argv[++i]);
+    } else {
+      throw std::invalid_argument("Unknown option: " + arg);
+    }
+  }
+  if (config.sizes.empty()) {
+    config.sizes = {10'000, 1'000'000, 100'000'000};
+  }
+  return config;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    const Config config = ParseConfig(argc, argv);
+    std::mt19937_64 rng(config.seed);
+    std::cout << "keys,phase,impl,seconds,ns_per_op\n";
+    for (size_t n : config.sizes) {
+      if (n == 0) {
+        throw std::invalid_argument("Sizes must be positive");
+      }
+      Run(n, config, rng);
+    }
+  } catch (const std::exception &ex) {
+    std::cerr << ex.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
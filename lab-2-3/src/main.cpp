@@ -1,31 +1,37 @@
 #include "containers/avl_tree.hpp"
+#include "containers/string_pool.hpp"
+#include "memory/alloc_stats.hpp"
 #include <fstream>
 #include <iostream>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 class Dict {
 public:
   Dict() : data() {}
 
-  bool AddWord(const std::string &word, uint64_t payload) {
-    if (data.Find(word)() != nullptr) {
-      return false;
+  bool AddWord(std::string_view word, uint64_t payload) {
+    const auto key = pool.Intern(word);
+    if (data.TryEmplace(key, payload).second) {
+      return true;
     }
-
-    data[word] = payload;
-    return true;
+    pool.Drop(key);
+    return false;
   }
 
-  bool RemoveWord(const std::string &word) {
-    if (data.Find(word)() == nullptr) {
+  bool RemoveWord(std::string_view word) {
+    const auto key = pool.Find(word);
+    if (key.IsNull() || !data.Remove(key)) {
       return false;
     }
-    data.Remove(word);
+    pool.Drop(key);
     return true;
   }
 
-  [[nodiscard]] std::optional<uint64_t> Find(const std::string &word) const {
+  [[nodiscard]] std::optional<uint64_t> Find(std::string_view word) const {
     const auto &it = data.Find(word);
     if (it()) {
       return it()->value;
@@ -46,24 +52,61 @@ public:
     fout.close();
   }
 
+  // The tree holds the only handles into the pool, so both start over.
+  // Dump writes keys in order, so the tree is normally built bottom-up in
+  // one pass; a file that is not sorted is inserted entry by entry.
   void Load(const std::string &filename) {
     std::ifstream fin(filename, std::ios::binary);
-      size_t size;
-      fin >> size;
-      data.Clear();
-      for (size_t i(0); i < size; ++i) {
-        std::string key;
-        uint64_t val;
-        fin >> key >> val;
-        data[key] = val;
+    size_t size = 0;
+    if (!(fin >> size)) {
+      throw std::runtime_error("Can't read dictionary from " + filename);
+    }
+    // The whole file is parsed before anything is dropped, so a missing or
+    // truncated file leaves the dictionary as it was. Keys wait back to back
+    // in one buffer rather than in a string each.
+    std::string keys;
+    std::vector<std::pair<size_t, uint64_t>> parsed;
+    std::string key;
+    uint64_t val;
+    for (size_t i(0); i < size; ++i) {
+      if (!(fin >> key >> val)) {
+        throw std::runtime_error("Can't read dictionary from " + filename);
       }
+      keys += key;
+      parsed.emplace_back(key.size(), val);
+    }
+    data.Clear();
+    pool.Clear();
+    std::vector<std::pair<tools::containers::PooledString, uint64_t>> entries;
+    entries.reserve(parsed.size());
+    size_t offset = 0;
+    for (const auto &[length, payload] : parsed) {
+      entries.emplace_back(
+          pool.Intern(std::string_view(keys).substr(offset, length)), payload);
+      offset += length;
+    }
+    if (data.BuildFromSorted(entries.begin(), entries.end())) {
+      return;
+    }
+    for (const auto &[word, payload] : entries) {
+      if (!data.TryEmplace(word, payload).second) {
+        data[word] = payload;
+        pool.Drop(word);
+      }
+    }
   }
 
 private:
-  tools::containers::AVLTree<std::string, uint64_t> data;
+  // Keys are interned: equal words share one copy and compare by pointer.
+  // The tree holds the one reference to each, dropped when the word is.
+  tools::containers::StringPool pool;
+  tools::containers::AVLTree<tools::containers::PooledString, uint64_t,
+                             std::allocator<uint64_t>, std::less<>>
+      data;
 };
 
-std::string str_tolower(std::string s) {
+// Lowercases s in place and returns it.
+std::string &str_tolower(std::string &s) {
   std::transform(s.begin(), s.end(), s.begin(),
                  [](unsigned char c){ return std::tolower(c); }
   );
@@ -71,13 +114,15 @@ std::string str_tolower(std::string s) {
 }
 
 int main() {
+  tools::memory::DumpAllocStatsAtExit();
   Dict dict;
-  std::string token;
+  // Reused for every command, so reading one allocates only when a word is
+  // longer than any seen before.
+  std::string token, key;
+  uint64_t val;
   while (std::cin >> token) {
     try {
       if (token == "+") {
-        std::string key;
-        uint64_t val;
         std::cin >> key >> val;
         const auto res = dict.AddWord(str_tolower(key), val);
         if (res) {
@@ -86,7 +131,6 @@ int main() {
           std::cout << "Exist" << std::endl;
         }
       } else if (token == "-") {
-        std::string key;
         std::cin >> key;
         const auto res = dict.RemoveWord(str_tolower(key));
         if (res) {
@@ -1,11 +1,220 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <optional>
 #include <string>
 #include <utility>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace {
+constexpr const size_t kSlabBytes = 1 << 16;
+} // namespace
+
+namespace tools::memory {
+
+// Container families that report their heap traffic.
+enum class AllocSite {
+  kVector,
+  kSmallVector,
+  kString,
+  kAVLTree,
+  kStringPool,
+  kSiteCount
+};
+
+// Opt-in heap accounting: build with -DALLOC_STATS to count, per container
+// family, the buffers taken and given back, how many of them replaced a
+// smaller buffer on growth, and the bytes live now and at peak. Without the
+// flag every hook below is an empty inline function and compiles away.
+//
+// Bytes are what the container asked for, not what malloc rounded them up to.
+// Storage placed in an Arena is counted where the container requested it;
+// the arena's own blocks are not counted again.
+#ifdef ALLOC_STATS
+
+namespace alloc_stats_internal {
+
+struct Counters {
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> deallocations{0};
+  std::atomic<size_t> reallocations{0};
+  std::atomic<size_t> live_bytes{0};
+  std::atomic<size_t> peak_bytes{0};
+};
+
+// One slot per site plus a process-wide total, so the total peak is a real
+// high-water mark rather than a sum of peaks reached at different times.
+inline Counters &Slot(AllocSite site) {
+  static Counters table[static_cast<size_t>(AllocSite::kSiteCount) + 1];
+  return table[static_cast<size_t>(site)];
+}
+
+inline void AddLive(Counters &c, size_t bytes) {
+  const size_t live =
+      c.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+  while (peak < live && !c.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+} // namespace alloc_stats_internal
+
+inline void RecordAllocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->allocations.fetch_add(1, std::memory_order_relaxed);
+    alloc_stats_internal::AddLive(*c, bytes);
+  }
+}
+
+inline void RecordDeallocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->deallocations.fetch_add(1, std::memory_order_relaxed);
+    c->live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+}
+
+// Marks that a live buffer was replaced by a bigger one. The new buffer and
+// the release of the old one are recorded separately.
+inline void RecordReallocation(AllocSite site) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->reallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void DumpAllocStats(std::ostream &os) {
+  static const char *const kNames[] = {"Vector",  "SmallVector", "String",
+                                       "AVLTree", "StringPool",  "total"};
+  char line[128];
+  std::snprintf(line, sizeof(line), "%-12s %12s %12s %12s %14s %14s\n",
+                "alloc stats", "allocs", "frees", "reallocs", "live bytes",
+                "peak bytes");
+  os << line;
+  for (size_t i(0); i <= static_cast<size_t>(AllocSite::kSiteCount); ++i) {
+    const auto &c = alloc_stats_internal::Slot(static_cast<AllocSite>(i));
+    std::snprintf(line, sizeof(line), "%-12s %12zu %12zu %12zu %14zu %14zu\n",
+                  kNames[i], c.allocations.load(), c.deallocations.load(),
+                  c.reallocations.load(), c.live_bytes.load(),
+                  c.peak_bytes.load());
+    os << line;
+  }
+  os.flush();
+}
+
+// Prints the table to stderr when the program exits. Call once from main;
+// repeated calls register a single dump.
+inline void DumpAllocStatsAtExit() {
+  static const bool registered =
+      std::atexit([] { DumpAllocStats(std::cerr); }) == 0;
+  (void)registered;
+}
+
+#else
+
+inline void RecordAllocation(AllocSite, size_t) {}
+inline void RecordDeallocation(AllocSite, size_t) {}
+inline void RecordReallocation(AllocSite) {}
+inline void DumpAllocStats(std::ostream &) {}
+inline void DumpAllocStatsAtExit() {}
+
+#endif
+
+
+// Pool of uninitialized slots for objects of one type. Slots are cut from
+// slabs of about kSlabBytes, taken from Alloc, in address order, and freed
+// slots go onto an intrusive free list that Allocate drains first, so in a
+// steady insert/erase mix no call reaches the underlying allocator. Slabs
+// are only given back all at once, by Release() or the destructor; it is up
+// to the owner to destroy the objects first.
+template <typename T, typename Alloc = std::allocator<T>> class SlabPool {
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+
+  static constexpr size_t kSlotsPerSlab =
+      sizeof(Slot) * 2 > kSlabBytes ? 2 : kSlabBytes / sizeof(Slot);
+
+  struct Slab {
+    Slab *next;
+    Slot slots[kSlotsPerSlab];
+  };
+
+  using SlabAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Slab>;
+  using SlabTraits = std::allocator_traits<SlabAlloc>;
+
+public:
+  explicit SlabPool(AllocSite site, const Alloc &alloc = Alloc())
+      : alloc_(alloc), site_(site) {}
+
+  SlabPool(const SlabPool &) = delete;
+  SlabPool &operator=(const SlabPool &) = delete;
+
+  ~SlabPool() { Release(); }
+
+  // Memory for one T; construct it with placement new.
+  T *Allocate() {
+    if (free_ != nullptr) {
+      Slot *slot = free_;
+      free_ = slot->next;
+      return reinterpret_cast<T *>(slot);
+    }
+    if (used_ == kSlotsPerSlab) {
+      Slab *slab = SlabTraits::allocate(alloc_, 1);
+      RecordAllocation(site_, sizeof(Slab));
+      slab->next = slabs_;
+      slabs_ = slab;
+      used_ = 0;
+    }
+    return reinterpret_cast<T *>(slabs_->slots[used_++].bytes);
+  }
+
+  // Takes back a slot whose object was already destroyed.
+  void Deallocate(T *data) noexcept {
+    Slot *slot = reinterpret_cast<Slot *>(data);
+    slot->next = free_;
+    free_ = slot;
+  }
+
+  void Release() noexcept {
+    while (slabs_ != nullptr) {
+      Slab *next = slabs_->next;
+      RecordDeallocation(site_, sizeof(Slab));
+      SlabTraits::deallocate(alloc_, slabs_, 1);
+      slabs_ = next;
+    }
+    free_ = nullptr;
+    used_ = kSlotsPerSlab;
+  }
+
+  [[nodiscard]] SlabAlloc GetAllocator() const { return alloc_; }
+
+private:
+  Slab *slabs_ = nullptr;
+  Slot *free_ = nullptr;
+  // Slots handed out from the newest slab; kSlotsPerSlab means "no room".
+  size_t used_ = kSlotsPerSlab;
+  [[no_unique_address]] SlabAlloc alloc_;
+  AllocSite site_;
+};
+
+} // namespace tools::memory
 
 namespace tools::containers {
 
@@ -25,13 +234,6 @@ template <typename Tk, typename Tv> struct Node {
     height = 1;
     parent = nullptr;
   }
-
-  explicit Node(const Tk &k, const Tv &v, Node<Tk, Tv> p) : key(k) {
-    value = v;
-    left = right = nullptr;
-    height = 1;
-    parent = p;
-  }
 };
 
 template <typename Tk, typename Tv> uint8_t Height(const Node<Tk, Tv> *node) {
@@ -48,22 +250,18 @@ template <typename Tk, typename Tv> void FixHeight(Node<Tk, Tv> *p) {
   p->height = (hl > hr ? hl : hr) + 1;
 }
 
+// Pivots keep every parent pointer right, including the new subtree root's,
+// which takes over p's parent; the parent's child link is left to the caller.
 template <typename Tk, typename Tv> Node<Tk, Tv> *RightPivot(Node<Tk, Tv> *p) {
   Node<Tk, Tv> *q = p->left;
 
   p->left = q->right;
-  q->right = p;
-
-  // parents
-  q->parent = p->parent;
-  p->parent = q;
-
   if (p->left) {
     p->left->parent = p;
   }
-  if (p->right) {
-    p->right->parent = p;
-  }
+  q->right = p;
+  q->parent = p->parent;
+  p->parent = q;
 
   FixHeight(p);
   FixHeight(q);
@@ -74,18 +272,13 @@ template <typename Tk, typename Tv> Node<Tk, Tv> *LeftPivot(Node<Tk, Tv> *q) {
   Node<Tk, Tv> *p = q->right;
 
   q->right = p->left;
+  if (q->right) {
+    q->right->parent = q;
+  }
   p->left = q;
-
-  // parents
   p->parent = q->parent;
   q->parent = p;
 
-  if (q->left) {
-    q->left->parent = q;
-  }
-  if (q->right) {
-    q->right->parent = q;
-  }
   FixHeight(q);
   FixHeight(p);
   return p;
@@ -96,111 +289,176 @@ template <typename Tk, typename Tv> Node<Tk, Tv> *Balance(Node<Tk, Tv> *p) {
   if (BFactor(p) == 2) {
     if (BFactor(p->right) < 0) {
       p->right = RightPivot(p->right);
-      p->right->parent = p;
     }
     return LeftPivot(p);
   }
   if (BFactor(p) == -2) {
     if (BFactor(p->left) > 0) {
       p->left = LeftPivot(p->left);
-      p->left->parent = p;
     }
     return RightPivot(p);
   }
   return p;
 }
 
+// Points whatever referred to old (parent's child link, or root) at node.
 template <typename Tk, typename Tv>
-Node<Tk, Tv> *Insert(Node<Tk, Tv> *p, const Tk &key, const Tv &val) {
-  if (!p)
-    return new Node<Tk, Tv>(key, val);
-  if (key < p->key && !p->left) {
-    p->left = new Node<Tk, Tv>(key, val);
-    p->left->parent = p;
-    return Balance(p);
-  } else if (key >= p->key && !p->right) {
-    p->right = new Node<Tk, Tv>(key, val);
-    p->right->parent = p;
-    return Balance(p);
-  }
-  if (key < p->key) {
-    p->left = Insert(p->left, key, val);
-    p->left->parent = p;
+void Relink(Node<Tk, Tv> *parent, Node<Tk, Tv> *old, Node<Tk, Tv> *node,
+            Node<Tk, Tv> *&root) {
+  if (node) {
+    node->parent = parent;
+  }
+  if (!parent) {
+    root = node;
+  } else if (parent->left == old) {
+    parent->left = node;
   } else {
-    p->right = Insert(p->right, key, val);
-    p->right->parent = p;
+    parent->right = node;
   }
-  return Balance(p);
 }
 
+// Walks from p to the root fixing heights and rotating where needed. Stops
+// as soon as a subtree comes out as high as it was, since nothing above it
+// can change then.
 template <typename Tk, typename Tv>
-Node<Tk, Tv> *Get(Node<Tk, Tv> *n, const Tk &key) {
-  if (!n)
-    return nullptr;
-  if (key < n->key) {
-    return Get(n->left, key);
-  } else if (key > n->key) {
-    return Get(n->right, key);
-  } else {
-    return n;
+void Rebalance(Node<Tk, Tv> *p, Node<Tk, Tv> *&root) {
+  while (p) {
+    Node<Tk, Tv> *parent = p->parent;
+    const auto height = p->height;
+    Node<Tk, Tv> *top = Balance(p);
+    if (top != p) {
+      Relink(parent, p, top, root);
+    } else if (top->height == height) {
+      return;
+    }
+    p = parent;
   }
 }
 
-template <typename Tk, typename Tv> Node<Tk, Tv> *FindMin(Node<Tk, Tv> *p) {
-  return p->left ? FindMin(p->left) : p;
+// Comparators such as std::less<> that accept mixed argument types mark
+// themselves with is_transparent; the tree then takes lookup keys of any
+// type they can compare with Tk.
+template <typename Compare>
+concept TransparentCompare = requires { typename Compare::is_transparent; };
+
+// Nodes live in the tree's SlabPool.
+template <typename Tk, typename Tv, typename Pool>
+Node<Tk, Tv> *NewNode(Pool &pool, const Tk &key, const Tv &val) {
+  Node<Tk, Tv> *node = pool.Allocate();
+  try {
+    new (node) Node<Tk, Tv>(key, val);
+  } catch (...) {
+    pool.Deallocate(node);
+    throw;
+  }
+  return node;
 }
 
-template <typename Tk, typename Tv> Node<Tk, Tv> *RemoveMin(Node<Tk, Tv> *p) {
-  if (p->left == nullptr)
-    return p->right;
-  p->left = RemoveMin(p->left);
-  if (p->left) {
-    p->left->parent = p;
+template <typename Tk, typename Tv, typename Pool>
+void DeleteNode(Pool &pool, Node<Tk, Tv> *node) {
+  node->~Node();
+  pool.Deallocate(node);
+}
+
+// Orders keys with less, which may also compare Tk against other key types
+// (see TransparentCompare).
+template <typename Tk, typename Tv, typename K, typename Compare>
+Node<Tk, Tv> *Get(Node<Tk, Tv> *n, const K &key, const Compare &less) {
+  while (n) {
+    if (less(key, n->key)) {
+      n = n->left;
+    } else if (less(n->key, key)) {
+      n = n->right;
+    } else {
+      return n;
+    }
   }
-  return Balance(p);
+  return nullptr;
 }
 
-template <typename Tk, typename Tv>
-Node<Tk, Tv> *RemoveNode(Node<Tk, Tv> *p, const Tk &k) {
-  if (!p)
-    return nullptr;
-  if (k < p->key) {
-    p->left = RemoveNode(p->left, k);
-    if (p->left) {
-      p->left->parent = p;
+// Single descent: returns the node holding key and false if there is one,
+// otherwise links a new node where the search ended, rebalances upward and
+// returns it with true.
+template <typename Tk, typename Tv, typename Pool, typename Compare>
+std::pair<Node<Tk, Tv> *, bool> Insert(Node<Tk, Tv> *&root, const Tk &key,
+                                       const Tv &val, Pool &pool,
+                                       const Compare &less) {
+  Node<Tk, Tv> *parent = nullptr;
+  Node<Tk, Tv> **link = &root;
+  while (*link) {
+    parent = *link;
+    if (less(key, parent->key)) {
+      link = &parent->left;
+    } else if (less(parent->key, key)) {
+      link = &parent->right;
+    } else {
+      return {parent, false};
     }
   }
+  Node<Tk, Tv> *node = NewNode(pool, key, val);
+  node->parent = parent;
+  *link = node;
+  Rebalance(parent, root);
+  return {node, true};
+}
+
+template <typename Tk, typename Tv> Node<Tk, Tv> *FindMin(Node<Tk, Tv> *p) {
+  while (p->left) {
+    p = p->left;
+  }
+  return p;
+}
 
-  else if (k > p->key) {
-    p->right = RemoveNode(p->right, k);
-    if (p->right) {
-      p->right->parent = p;
+// Unlinks node and frees it. A node with two children is replaced by its
+// successor, which is moved rather than copied since keys are const.
+template <typename Tk, typename Tv, typename Pool>
+void RemoveNode(Node<Tk, Tv> *node, Node<Tk, Tv> *&root, Pool &pool) {
+  Node<Tk, Tv> *parent = node->parent;
+  Node<Tk, Tv> *start;
+  if (node->left && node->right) {
+    Node<Tk, Tv> *next = FindMin(node->right);
+    if (next->parent == node) {
+      start = next;
+    } else {
+      start = next->parent;
+      start->left = next->right;
+      if (next->right) {
+        next->right->parent = start;
+      }
+      next->right = node->right;
+      next->right->parent = next;
     }
+    next->left = node->left;
+    next->left->parent = next;
+    next->height = node->height;
+    Relink(parent, node, next, root);
   } else {
-    Node<Tk, Tv> *l = p->left;
-    Node<Tk, Tv> *r = p->right;
-    delete p;
-    if (l) {
-      l->parent = nullptr;
-    }
-    if (!r) {
-      return l;
-    }
-    r->parent = nullptr;
+    Node<Tk, Tv> *child = node->left ? node->left : node->right;
+    Relink(parent, node, child, root);
+    start = parent;
+  }
+  DeleteNode(pool, node);
+  Rebalance(start, root);
+}
 
-    Node<Tk, Tv> *min = FindMin(r);
-    min->right = RemoveMin(r);
-    if (min->right) {
-      min->right->parent = min;
-    }
-    min->left = l;
-    if (min->left) {
-      min->left->parent = min;
-    }
-    min->parent = nullptr;
-    return Balance(min);
+// Builds a perfectly balanced tree from count entries at first, taking the
+// middle one as the root of each subtree. Every node is linked into place
+// before its subtrees are built, so if a constructor throws, what was built
+// so far is still a tree the caller can destroy.
+template <typename Tk, typename Tv, typename It, typename Pool>
+void BuildBalanced(It first, size_t count, Node<Tk, Tv> *parent,
+                   Node<Tk, Tv> *&link, Pool &pool) {
+  if (count == 0) {
+    return;
   }
-  return Balance(p);
+  const size_t mid = count / 2;
+  Node<Tk, Tv> *node =
+      NewNode<Tk, Tv>(pool, first[mid].first, first[mid].second);
+  node->parent = parent;
+  link = node;
+  BuildBalanced(first, mid, node, node->left, pool);
+  BuildBalanced(first + mid + 1, count - mid - 1, node, node->right, pool);
+  FixHeight(node);
 }
 
 } // namespace
@@ -270,7 +528,12 @@ private:
   Node<Tk, Tv> *prev;
 };
 
-template <typename Tk, typename Tv> class AVLTree {
+// Nodes come from a per-tree SlabPool: they are cut from contiguous slabs,
+// removed nodes are reused before the slabs grow, and Clear() gives back
+// whole slabs. Keys are ordered by Compare; a transparent one such as
+// std::less<> also enables Find and Remove by other key types.
+template <typename Tk, typename Tv, typename Compare = std::less<Tk>>
+class AVLTree {
 public:
   AVLTree() {
     root = nullptr;
@@ -278,7 +541,7 @@ public:
   }
 
   const Tv &operator[](const Tk &key) const {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
     if (node == nullptr) {
       throw std::runtime_error("Node with this key doesn't exists");
     } else {
@@ -286,15 +549,17 @@ public:
     }
   }
 
-  Tv &operator[](const Tk &key) {
-    auto node = Get(root, key);
-    if (node == nullptr) {
-      root = Insert(root, key, Tv());
+  Tv &operator[](const Tk &key) { return TryEmplace(key).first()->value; }
+
+  // Adds key with value unless key is already present. Returns the node for
+  // key either way, and whether it was added, after a single descent.
+  std::pair<AVLTreeIterator<Tk, Tv>, bool> TryEmplace(const Tk &key,
+                                                      const Tv &value = Tv()) {
+    const auto [node, inserted] = Insert(root, key, value, pool, less);
+    if (inserted) {
       ++size;
-      return Get(root, key)->value;
-    } else {
-      return node->value;
     }
+    return {AVLTreeIterator<Tk, Tv>(node), inserted};
   }
 
   AVLTreeIterator<Tk, Tv> Begin() {
@@ -308,47 +573,427 @@ public:
     return AVLTreeIterator(n);
   }
 
-  void Remove(const Tk &key) {
-    root = RemoveNode(root, key);
+  // Returns whether key was there to remove.
+  bool Remove(const Tk &key) {
+    auto node = Get(root, key, less);
+    if (node == nullptr) {
+      return false;
+    }
+    RemoveNode(node, root, pool);
     --size;
+    return true;
   }
 
   AVLTreeIterator<Tk, Tv> Find(const Tk &key) {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
     return AVLTreeIterator(node);
   }
 
   AVLTreeIterator<Tk, Tv> Find(const Tk &key) const {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
     return AVLTreeIterator(node);
   }
 
+  // Lookups by any type Compare orders against Tk, without building a Tk.
+  template <typename K>
+    requires TransparentCompare<Compare>
+  AVLTreeIterator<Tk, Tv> Find(const K &key) const {
+    auto node = Get(root, key, less);
+    return AVLTreeIterator(node);
+  }
+
+  template <typename K>
+    requires TransparentCompare<Compare>
+  bool Remove(const K &key) {
+    auto node = Get(root, key, less);
+    if (node == nullptr) {
+      return false;
+    }
+    RemoveNode(node, root, pool);
+    --size;
+    return true;
+  }
+
+  // Replaces the contents with the (key, value) pairs in [first, last) in
+  // O(n), without a single comparison-driven descent or rotation. Keys must
+  // be strictly increasing; if they are not, returns false and leaves the
+  // tree as it was.
+  template <std::random_access_iterator It>
+  bool BuildFromSorted(It first, It last) {
+    const size_t count = last - first;
+    for (size_t i(1); i < count; ++i) {
+      if (!less(first[i - 1].first, first[i].first)) {
+        return false;
+      }
+    }
+    Clear();
+    try {
+      BuildBalanced(first, count, static_cast<Node<Tk, Tv> *>(nullptr), root,
+                    pool);
+    } catch (...) {
+      Clear();
+      throw;
+    }
+    size = count;
+    return true;
+  }
+
   ~AVLTree() { Clear(); }
 
   void Clear() {
-    Clear(root);
+    if constexpr (!std::is_trivially_destructible_v<Node<Tk, Tv>>) {
+      Destroy(root);
+    }
+    pool.Release();
     root = nullptr;
     size = 0;
   }
   size_t Size() { return size; }
 
 private:
-  void Clear(Node<Tk, Tv> *node) {
+  // Runs the node destructors only; the memory goes back with the slabs.
+  void Destroy(Node<Tk, Tv> *node) {
     if (!node) {
       return;
     }
-    if (node->left) {
-      Clear(node->left);
+    Destroy(node->left);
+    Destroy(node->right);
+    node->~Node();
+  }
+
+  Node<Tk, Tv> *root;
+  size_t size;
+  [[no_unique_address]] Compare less;
+  memory::SlabPool<Node<Tk, Tv>> pool{memory::AllocSite::kAVLTree};
+};
+
+} // namespace tools::containers
+
+namespace {
+constexpr const size_t kStringPoolPageSize = 1 << 16;
+constexpr const size_t kStringPoolInitSlots = 64;
+constexpr const size_t kStringPoolMaxPagedEntry = 256;
+} // namespace
+
+namespace tools::containers {
+
+// Handle to a string owned by a StringPool. Two handles from the same pool
+// are equal exactly when they point at the same bytes, so == is a pointer
+// compare; ordering falls back to the contents and matches std::string's.
+class PooledString {
+public:
+  PooledString() = default;
+
+  [[nodiscard]] const char *Data() const noexcept {
+    return data_ ? data_ : "";
+  }
+  [[nodiscard]] size_t Size() const noexcept {
+    return data_ ? Header(data_)->size : 0;
+  }
+  [[nodiscard]] std::string_view View() const noexcept {
+    return {Data(), Size()};
+  }
+  [[nodiscard]] bool IsNull() const noexcept { return data_ == nullptr; }
+
+  friend bool operator==(PooledString l, PooledString r) {
+    return l.data_ == r.data_;
+  }
+  friend bool operator!=(PooledString l, PooledString r) {
+    return l.data_ != r.data_;
+  }
+  friend bool operator<(PooledString l, PooledString r) {
+    return l.data_ != r.data_ && l.View() < r.View();
+  }
+  friend bool operator>(PooledString l, PooledString r) { return r < l; }
+  friend bool operator<=(PooledString l, PooledString r) { return !(r < l); }
+  friend bool operator>=(PooledString l, PooledString r) { return !(l < r); }
+
+  // Mixed comparisons let a tree keyed by PooledString be searched with a
+  // plain string_view (e.g. through std::less<>) before or without interning.
+  friend bool operator==(PooledString l, std::string_view r) {
+    return l.View() == r;
+  }
+  friend bool operator<(PooledString l, std::string_view r) {
+    return l.View() < r;
+  }
+  friend bool operator<(std::string_view l, PooledString r) {
+    return l < r.View();
+  }
+
+private:
+  friend class StringPool;
+
+  struct EntryHeader {
+    uint32_t size;
+    uint32_t hash;
+    uint32_t refs;
+  };
+
+  explicit PooledString(const char *data) : data_(data) {}
+
+  static const EntryHeader *Header(const char *data) {
+    return reinterpret_cast<const EntryHeader *>(data) - 1;
+  }
+
+  const char *data_ = nullptr;
+};
+
+inline std::ostream &operator<<(std::ostream &os, PooledString s) {
+  return os << s.View();
+}
+
+// Deduplicating, reference-counted string storage. Every distinct string is
+// copied once, behind a small header with its size, hash and reference count,
+// and is found again through an open-addressing table. Short strings are
+// packed into pages and their space is reused through per-size free lists;
+// long ones get an allocation of their own. A handle stays valid until every
+// Intern that returned it has been matched by a Drop, or the pool is cleared.
+class StringPool {
+public:
+  StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+
+  ~StringPool() { ReleaseMemory(); }
+
+  // Returns the handle for str, copying it into the pool on first sight, and
+  // takes one reference to it.
+  PooledString Intern(std::string_view str) {
+    if (str.size() > UINT32_MAX) {
+      throw std::length_error("String is too long for the pool");
+    }
+    const uint32_t hash = Hash(str);
+    if ((count_ + 1) * 4 > slots_.size() * 3) {
+      Rehash(slots_.size() == 0 ? kStringPoolInitSlots : slots_.size() * 2);
+    }
+    size_t slot = Probe(str, hash);
+    if (slots_[slot] == nullptr) {
+      slots_[slot] = Store(str, hash);
+      ++count_;
+    } else {
+      EntryHeader *header = MutableHeader(slots_[slot]);
+      // A saturated count pins the string until Clear.
+      if (header->refs != UINT32_MAX) {
+        ++header->refs;
+      }
+    }
+    return PooledString(slots_[slot]);
+  }
+
+  // Gives back one reference taken by Intern. The string is freed with the
+  // last one and its handles become invalid.
+  void Drop(PooledString str) {
+    if (str.IsNull()) {
+      return;
     }
-    if (node->right) {
-      Clear(node->right);
+    EntryHeader *header = MutableHeader(str.data_);
+    if (header->refs == UINT32_MAX || --header->refs != 0) {
+      return;
     }
+    Erase(SlotOf(str.data_));
+    --count_;
+    Free(str.data_);
+  }
 
-    delete node;
+  // Returns the handle for str if it was interned before, an empty handle
+  // otherwise. Never allocates.
+  [[nodiscard]] PooledString Find(std::string_view str) const {
+    if (count_ == 0) {
+      return {};
+    }
+    return PooledString(slots_[Probe(str, Hash(str))]);
   }
 
-  Node<Tk, Tv> *root;
-  size_t size;
+  // Number of distinct strings held.
+  [[nodiscard]] size_t Size() const noexcept { return count_; }
+
+  // Drops every string at once; all handles handed out become invalid.
+  void Clear() {
+    ReleaseMemory();
+    pages_ = std::vector<std::unique_ptr<char[]>>();
+    slots_ = std::vector<const char *>();
+    std::fill(std::begin(free_), std::end(free_), nullptr);
+    current_ = end_ = nullptr;
+    count_ = 0;
+  }
+
+private:
+  using EntryHeader = PooledString::EntryHeader;
+
+  // A free entry keeps the link to the next one of its size where its header
+  // was.
+  static_assert(sizeof(EntryHeader) >= sizeof(char *));
+
+  static EntryHeader *MutableHeader(const char *data) {
+    return const_cast<EntryHeader *>(PooledString::Header(data));
+  }
+
+  // Multiplicative hash over 8-byte words; the tail is read as a partial
+  // word so short keys cost one or two multiplications.
+  static uint32_t Hash(std::string_view str) {
+    constexpr uint64_t kMul = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = str.size() * kMul;
+    size_t i(0);
+    for (; i + 8 <= str.size(); i += 8) {
+      uint64_t word;
+      memcpy(&word, str.data() + i, 8);
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 29;
+    }
+    if (i < str.size()) {
+      uint64_t word = 0;
+      memcpy(&word, str.data() + i, str.size() - i);
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 29;
+    }
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+  }
+
+  // Slot holding str, or the empty slot where it would go.
+  [[nodiscard]] size_t Probe(std::string_view str, uint32_t hash) const {
+    const size_t mask = slots_.size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+      const char *data = slots_[slot];
+      if (data == nullptr) {
+        return slot;
+      }
+      const EntryHeader *header = PooledString::Header(data);
+      if (header->hash == hash && header->size == str.size() &&
+          (str.empty() || memcmp(data, str.data(), str.size()) == 0)) {
+        return slot;
+      }
+    }
+  }
+
+  // Slot holding exactly the entry at data, which must be in the table.
+  [[nodiscard]] size_t SlotOf(const char *data) const {
+    const size_t mask = slots_.size() - 1;
+    size_t slot = PooledString::Header(data)->hash & mask;
+    while (slots_[slot] != data) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  // Empties slot without tombstones: later entries of the probe run are
+  // shifted back into the hole unless that would move them before their home
+  // slot.
+  void Erase(size_t slot) {
+    const size_t mask = slots_.size() - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; slots_[next] != nullptr;
+         next = (next + 1) & mask) {
+      const size_t home = PooledString::Header(slots_[next])->hash & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        slots_[hole] = slots_[next];
+        hole = next;
+      }
+    }
+    slots_[hole] = nullptr;
+  }
+
+  void Rehash(size_t slots) {
+    std::vector<const char *> old(std::move(slots_));
+    slots_.assign(slots, nullptr);
+    const size_t mask = slots - 1;
+    for (size_t i(0); i < old.size(); ++i) {
+      if (old[i] == nullptr) {
+        continue;
+      }
+      size_t slot = PooledString::Header(old[i])->hash & mask;
+      while (slots_[slot] != nullptr) {
+        slot = (slot + 1) & mask;
+      }
+      slots_[slot] = old[i];
+    }
+  }
+
+  // Space an entry for a string of size bytes takes.
+  static size_t EntryBytes(size_t size) {
+    constexpr size_t kAlign = alignof(EntryHeader);
+    return (sizeof(EntryHeader) + size + 1 + kAlign - 1) & ~(kAlign - 1);
+  }
+
+  static char *EntryOf(const char *data) {
+    return reinterpret_cast<char *>(MutableHeader(data));
+  }
+
+  // Pages go back with the pool; long entries are found through the table.
+  void ReleaseMemory() noexcept {
+    for (size_t i(0); i < slots_.size(); ++i) {
+      if (slots_[i] != nullptr &&
+          EntryBytes(PooledString::Header(slots_[i])->size) >
+              kStringPoolMaxPagedEntry) {
+        Free(slots_[i]);
+      }
+    }
+    for (size_t i(0); i < pages_.size(); ++i) {
+      memory::RecordDeallocation(memory::AllocSite::kStringPool,
+                                 kStringPoolPageSize);
+    }
+  }
+
+  // Space for an entry of the given size: a freed one of the same size, the
+  // tail of the current page or a new page. Long entries are allocated alone.
+  char *Allocate(size_t bytes) {
+    if (bytes > kStringPoolMaxPagedEntry) {
+      memory::RecordAllocation(memory::AllocSite::kStringPool, bytes);
+      return new char[bytes];
+    }
+    char *&head = free_[bytes / alignof(EntryHeader)];
+    if (head != nullptr) {
+      char *entry = head;
+      memcpy(&head, entry, sizeof(char *));
+      return entry;
+    }
+    if (current_ == nullptr || static_cast<size_t>(end_ - current_) < bytes) {
+      pages_.emplace_back(new char[kStringPoolPageSize]);
+      memory::RecordAllocation(memory::AllocSite::kStringPool,
+                               kStringPoolPageSize);
+      current_ = pages_.back().get();
+      end_ = current_ + kStringPoolPageSize;
+    }
+    char *entry = current_;
+    current_ += bytes;
+    return entry;
+  }
+
+  void Free(const char *data) noexcept {
+    const size_t bytes = EntryBytes(PooledString::Header(data)->size);
+    char *entry = EntryOf(data);
+    if (bytes > kStringPoolMaxPagedEntry) {
+      memory::RecordDeallocation(memory::AllocSite::kStringPool, bytes);
+      delete[] entry;
+      return;
+    }
+    char *&head = free_[bytes / alignof(EntryHeader)];
+    memcpy(entry, &head, sizeof(char *));
+    head = entry;
+  }
+
+  // Copies str behind its header, terminated by '\0' so Data() can be handed
+  // to C APIs.
+  const char *Store(std::string_view str, uint32_t hash) {
+    char *entry = Allocate(EntryBytes(str.size()));
+    auto *header = reinterpret_cast<EntryHeader *>(entry);
+    header->size = static_cast<uint32_t>(str.size());
+    header->hash = hash;
+    header->refs = 1;
+    char *data = entry + sizeof(EntryHeader);
+    if (!str.empty()) {
+      memcpy(data, str.data(), str.size());
+    }
+    data[str.size()] = '\0';
+    return data;
+  }
+
+  std::vector<std::unique_ptr<char[]>> pages_;
+  std::vector<const char *> slots_;
+  // Heads of the free lists of paged entries, indexed by size / alignment.
+  char *free_[kStringPoolMaxPagedEntry / alignof(EntryHeader) + 1] = {};
+  char *current_ = nullptr;
+  char *end_ = nullptr;
+  size_t count_ = 0;
 };
 
 } // namespace tools::containers
@@ -357,24 +1002,25 @@ class Dict {
 public:
   Dict() : data() {}
 
-  bool AddWord(const std::string &word, uint64_t payload) {
-    if (data.Find(word)() != nullptr) {
-      return false;
+  bool AddWord(std::string_view word, uint64_t payload) {
+    const auto key = pool.Intern(word);
+    if (data.TryEmplace(key, payload).second) {
+      return true;
     }
-
-    data[word] = payload;
-    return true;
+    pool.Drop(key);
+    return false;
   }
 
-  bool RemoveWord(const std::string &word) {
-    if (data.Find(word)() == nullptr) {
+  bool RemoveWord(std::string_view word) {
+    const auto key = pool.Find(word);
+    if (key.IsNull() || !data.Remove(key)) {
       return false;
     }
-    data.Remove(word);
+    pool.Drop(key);
     return true;
   }
 
-  [[nodiscard]] std::optional<uint64_t> Find(const std::string &word) const {
+  [[nodiscard]] std::optional<uint64_t> Find(std::string_view word) const {
     const auto &it = data.Find(word);
     if (it()) {
       return it()->value;
@@ -395,16 +1041,47 @@ public:
     fout.close();
   }
 
+  // The tree holds the only handles into the pool, so both start over.
+  // Dump writes keys in order, so the tree is normally built bottom-up in
+  // one pass; a file that is not sorted is inserted entry by entry.
   void Load(const std::string &filename) {
     std::ifstream fin(filename, std::ios::binary);
-    size_t size;
-    fin >> size;
-    data.Clear();
+    size_t size = 0;
+    if (!(fin >> size)) {
+      throw std::runtime_error("Can't read dictionary from " + filename);
+    }
+    // The whole file is parsed before anything is dropped, so a missing or
+    // truncated file leaves the dictionary as it was. Keys wait back to back
+    // in one buffer rather than in a string each.
+    std::string keys;
+    std::vector<std::pair<size_t, uint64_t>> parsed;
+    std::string key;
+    uint64_t val;
     for (size_t i(0); i < size; ++i) {
-      std::string key;
-      uint64_t val;
-      fin >> key >> val;
-      data[key] = val;
+      if (!(fin >> key >> val)) {
+        throw std::runtime_error("Can't read dictionary from " + filename);
+      }
+      keys += key;
+      parsed.emplace_back(key.size(), val);
+    }
+    data.Clear();
+    pool.Clear();
+    std::vector<std::pair<tools::containers::PooledString, uint64_t>> entries;
+    entries.reserve(parsed.size());
+    size_t offset = 0;
+    for (const auto &[length, payload] : parsed) {
+      entries.emplace_back(
+          pool.Intern(std::string_view(keys).substr(offset, length)), payload);
+      offset += length;
+    }
+    if (data.BuildFromSorted(entries.begin(), entries.end())) {
+      return;
+    }
+    for (const auto &[word, payload] : entries) {
+      if (!data.TryEmplace(word, payload).second) {
+        data[word] = payload;
+        pool.Drop(word);
+      }
     }
   }
 
@@ -430,25 +1107,33 @@ public:
 #endif
 
 private:
-  tools::containers::AVLTree<std::string, uint64_t> data;
+  // Keys are interned: equal words share one copy and compare by pointer.
+  // The tree holds the one reference to each, dropped when the word is.
+  tools::containers::StringPool pool;
+  tools::containers::AVLTree<tools::containers::PooledString, uint64_t,
+                             std::less<>>
+      data;
 };
 
-std::string str_tolower(std::string s) {
+// Lowercases s in place and returns it.
+std::string &str_tolower(std::string &s) {
   std::transform(s.begin(), s.end(), s.begin(),
                  [](unsigned char c) { return std::tolower(c); });
   return s;
 }
 
 int main() {
+  tools::memory::DumpAllocStatsAtExit();
   std::ios_base::sync_with_stdio(false);
   std::cin.tie(nullptr);
   Dict dict;
-  std::string token;
+  // Reused for every command, so reading one allocates only when a word is
+  // longer than any seen before.
+  std::string token, key;
+  uint64_t val;
   while (std::cin >> token) {
     try {
       if (token == "+") {
-        std::string key;
-        uint64_t val;
         std::cin >> key >> val;
         const auto res = dict.AddWord(str_tolower(key), val);
         if (res) {
@@ -458,7 +1143,6 @@ int main() {
         }
 
       } else if (token == "-") {
-        std::string key;
         std::cin >> key;
         const auto res = dict.RemoveWord(str_tolower(key));
         if (res) {
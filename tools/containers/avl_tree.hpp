@@ -1,6 +1,19 @@
 #pragma once
 #include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
 #include <optional>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "../memory/alloc_stats.hpp"
+#include "../memory/slab_pool.hpp"
+
+#ifdef DEBUG
+#include "../memory/arena.hpp"
+#endif
 
 namespace tools::containers {
 namespace {
@@ -19,13 +32,6 @@ template <typename Tk, typename Tv> struct Node {
     height = 1;
     parent = nullptr;
   }
-
-  explicit Node(const Tk &k, const Tv &v, Node<Tk, Tv> p) : key(k) {
-    value = v;
-    left = right = nullptr;
-    height = 1;
-    parent = p;
-  }
 };
 
 template <typename Tk, typename Tv> uint8_t Height(const Node<Tk, Tv> *node) {
@@ -42,16 +48,19 @@ template <typename Tk, typename Tv> void FixHeight(Node<Tk, Tv> *p) {
   p->height = (hl > hr ? hl : hr) + 1;
 }
 
+// Pivots keep every parent pointer right, including the new subtree root's,
+// which takes over p's parent; the parent's child link is left to the caller.
 template <typename Tk, typename Tv> Node<Tk, Tv> *RightPivot(Node<Tk, Tv> *p) {
   Node<Tk, Tv> *q = p->left;
 
-  p->parent = nullptr;
-  q->parent = p;
-  if (p->right) {
-    p->right->parent = q;
-  }
   p->left = q->right;
+  if (p->left) {
+    p->left->parent = p;
+  }
   q->right = p;
+  q->parent = p->parent;
+  p->parent = q;
+
   FixHeight(p);
   FixHeight(q);
   return q;
@@ -60,14 +69,14 @@ template <typename Tk, typename Tv> Node<Tk, Tv> *RightPivot(Node<Tk, Tv> *p) {
 template <typename Tk, typename Tv> Node<Tk, Tv> *LeftPivot(Node<Tk, Tv> *q) {
   Node<Tk, Tv> *p = q->right;
 
-  p->parent = nullptr;
-  q->parent = p;
-  if (p->left) {
-    p->left->parent = q;
-  }
-
   q->right = p->left;
+  if (q->right) {
+    q->right->parent = q;
+  }
   p->left = q;
+  p->parent = q->parent;
+  q->parent = p;
+
   FixHeight(q);
   FixHeight(p);
   return p;
@@ -78,108 +87,176 @@ template <typename Tk, typename Tv> Node<Tk, Tv> *Balance(Node<Tk, Tv> *p) {
   if (BFactor(p) == 2) {
     if (BFactor(p->right) < 0) {
       p->right = RightPivot(p->right);
-      p->right->parent = p;
     }
     return LeftPivot(p);
   }
   if (BFactor(p) == -2) {
     if (BFactor(p->left) > 0) {
       p->left = LeftPivot(p->left);
-      p->left->parent = p;
     }
     return RightPivot(p);
   }
   return p;
 }
 
+// Points whatever referred to old (parent's child link, or root) at node.
 template <typename Tk, typename Tv>
-Node<Tk, Tv> *Insert(Node<Tk, Tv> *p, const Tk &key, const Tv &val) {
-  if (!p)
-    return new Node<Tk, Tv>(key, val);
-  if (key < p->key && !p->left) {
-    p->left = new Node<Tk, Tv>(key, val);
-    p->left->parent = p;
-    return Balance(p);
-  } else if (key >= p->key && !p->right) {
-    p->right = new Node<Tk, Tv>(key, val);
-    p->right->parent = p;
-    return Balance(p);
+void Relink(Node<Tk, Tv> *parent, Node<Tk, Tv> *old, Node<Tk, Tv> *node,
+            Node<Tk, Tv> *&root) {
+  if (node) {
+    node->parent = parent;
   }
-  if (key < p->key) {
-    p->left = Insert(p->left, key, val);
+  if (!parent) {
+    root = node;
+  } else if (parent->left == old) {
+    parent->left = node;
   } else {
-    p->right = Insert(p->right, key, val);
+    parent->right = node;
   }
-  return Balance(p);
 }
 
+// Walks from p to the root fixing heights and rotating where needed. Stops
+// as soon as a subtree comes out as high as it was, since nothing above it
+// can change then.
 template <typename Tk, typename Tv>
-Node<Tk, Tv> *Get(Node<Tk, Tv> *n, const Tk &key) {
-  if (!n)
-    return nullptr;
-  if (key < n->key) {
-    return Get(n->left, key);
-  } else if (key > n->key) {
-    return Get(n->right, key);
-  } else {
-    return n;
+void Rebalance(Node<Tk, Tv> *p, Node<Tk, Tv> *&root) {
+  while (p) {
+    Node<Tk, Tv> *parent = p->parent;
+    const auto height = p->height;
+    Node<Tk, Tv> *top = Balance(p);
+    if (top != p) {
+      Relink(parent, p, top, root);
+    } else if (top->height == height) {
+      return;
+    }
+    p = parent;
   }
 }
 
-template <typename Tk, typename Tv> Node<Tk, Tv> *FindMin(Node<Tk, Tv> *p) {
-  return p->left ? FindMin(p->left) : p;
+// Comparators such as std::less<> that accept mixed argument types mark
+// themselves with is_transparent; the tree then takes lookup keys of any
+// type they can compare with Tk.
+template <typename Compare>
+concept TransparentCompare = requires { typename Compare::is_transparent; };
+
+// Nodes live in the tree's SlabPool.
+template <typename Tk, typename Tv, typename Pool>
+Node<Tk, Tv> *NewNode(Pool &pool, const Tk &key, const Tv &val) {
+  Node<Tk, Tv> *node = pool.Allocate();
+  try {
+    new (node) Node<Tk, Tv>(key, val);
+  } catch (...) {
+    pool.Deallocate(node);
+    throw;
+  }
+  return node;
 }
 
-template <typename Tk, typename Tv> Node<Tk, Tv> *RemoveMin(Node<Tk, Tv> *p) {
-  if (p->left == nullptr)
-    return p->right;
-  p->left = RemoveMin(p->left);
-  if (p->left) {
-    p->left->parent = p;
+template <typename Tk, typename Tv, typename Pool>
+void DeleteNode(Pool &pool, Node<Tk, Tv> *node) {
+  node->~Node();
+  pool.Deallocate(node);
+}
+
+// Orders keys with less, which may also compare Tk against other key types
+// (see TransparentCompare).
+template <typename Tk, typename Tv, typename K, typename Compare>
+Node<Tk, Tv> *Get(Node<Tk, Tv> *n, const K &key, const Compare &less) {
+  while (n) {
+    if (less(key, n->key)) {
+      n = n->left;
+    } else if (less(n->key, key)) {
+      n = n->right;
+    } else {
+      return n;
+    }
   }
-  return Balance(p);
+  return nullptr;
 }
 
-template <typename Tk, typename Tv>
-Node<Tk, Tv> *RemoveNode(Node<Tk, Tv> *p, const Tk &k) {
-  if (!p)
-    return nullptr;
-  if (k < p->key) {
-    p->left = RemoveNode(p->left, k);
-    if (p->left) {
-      p->left->parent = p;
+// Single descent: returns the node holding key and false if there is one,
+// otherwise links a new node where the search ended, rebalances upward and
+// returns it with true.
+template <typename Tk, typename Tv, typename Pool, typename Compare>
+std::pair<Node<Tk, Tv> *, bool> Insert(Node<Tk, Tv> *&root, const Tk &key,
+                                       const Tv &val, Pool &pool,
+                                       const Compare &less) {
+  Node<Tk, Tv> *parent = nullptr;
+  Node<Tk, Tv> **link = &root;
+  while (*link) {
+    parent = *link;
+    if (less(key, parent->key)) {
+      link = &parent->left;
+    } else if (less(parent->key, key)) {
+      link = &parent->right;
+    } else {
+      return {parent, false};
     }
   }
+  Node<Tk, Tv> *node = NewNode(pool, key, val);
+  node->parent = parent;
+  *link = node;
+  Rebalance(parent, root);
+  return {node, true};
+}
+
+template <typename Tk, typename Tv> Node<Tk, Tv> *FindMin(Node<Tk, Tv> *p) {
+  while (p->left) {
+    p = p->left;
+  }
+  return p;
+}
 
-  else if (k > p->key) {
-    p->right = RemoveNode(p->right, k);
-    if (p->right) {
-      p->right->parent = p;
+// Unlinks node and frees it. A node with two children is replaced by its
+// successor, which is moved rather than copied since keys are const.
+template <typename Tk, typename Tv, typename Pool>
+void RemoveNode(Node<Tk, Tv> *node, Node<Tk, Tv> *&root, Pool &pool) {
+  Node<Tk, Tv> *parent = node->parent;
+  Node<Tk, Tv> *start;
+  if (node->left && node->right) {
+    Node<Tk, Tv> *next = FindMin(node->right);
+    if (next->parent == node) {
+      start = next;
+    } else {
+      start = next->parent;
+      start->left = next->right;
+      if (next->right) {
+        next->right->parent = start;
+      }
+      next->right = node->right;
+      next->right->parent = next;
     }
+    next->left = node->left;
+    next->left->parent = next;
+    next->height = node->height;
+    Relink(parent, node, next, root);
   } else {
-    Node<Tk, Tv> *l = p->left;
-    Node<Tk, Tv> *r = p->right;
-    delete p;
-    if (l) {
-      l->parent = nullptr;
-    }
-    if (!r) {
-      return l;
-    }
-    r->parent = nullptr;
+    Node<Tk, Tv> *child = node->left ? node->left : node->right;
+    Relink(parent, node, child, root);
+    start = parent;
+  }
+  DeleteNode(pool, node);
+  Rebalance(start, root);
+}
 
-    Node<Tk, Tv> *min = FindMin(r);
-    min->right = RemoveMin(r);
-    if (min->right) {
-      min->right->parent = min;
-    }
-    min->left = l;
-    if (min->left) {
-      min->left->parent = min;
-    }
-    return Balance(min);
+// Builds a perfectly balanced tree from count entries at first, taking the
+// middle one as the root of each subtree. Every node is linked into place
+// before its subtrees are built, so if a constructor throws, what was built
+// so far is still a tree the caller can destroy.
+template <typename Tk, typename Tv, typename It, typename Pool>
+void BuildBalanced(It first, size_t count, Node<Tk, Tv> *parent,
+                   Node<Tk, Tv> *&link, Pool &pool) {
+  if (count == 0) {
+    return;
   }
-  return Balance(p);
+  const size_t mid = count / 2;
+  Node<Tk, Tv> *node =
+      NewNode<Tk, Tv>(pool, first[mid].first, first[mid].second);
+  node->parent = parent;
+  link = node;
+  BuildBalanced(first, mid, node, node->left, pool);
+  BuildBalanced(first + mid + 1, count - mid - 1, node, node->right, pool);
+  FixHeight(node);
 }
 
 } // namespace
@@ -210,7 +287,15 @@ public:
         }
         prev = current->parent;
       } else {
-        current = current->parent;
+        while (current->parent && current->parent->right == current) {
+          current = current->parent;
+        }
+        prev = current;
+        if (current->parent) {
+          current = current->parent;
+        } else {
+          current = nullptr;
+        }
       }
     } else if (current->right == prev) {
       prev = current;
@@ -241,15 +326,30 @@ private:
   Node<Tk, Tv> *prev;
 };
 
-template <typename Tk, typename Tv> class AVLTree {
+// Nodes come from a per-tree SlabPool: they are cut from contiguous slabs,
+// removed nodes are reused before the slabs grow, and Clear() gives back
+// whole slabs. The slabs themselves are allocated through Alloc, so an
+// ArenaAllocator (tools/memory/arena.hpp) places the whole tree in one arena.
+// Keys are ordered by Compare; a transparent one such as std::less<> also
+// enables Find and Remove by other key types.
+template <typename Tk, typename Tv,
+          typename Alloc = std::allocator<std::pair<const Tk, Tv>>,
+          typename Compare = std::less<Tk>>
+class AVLTree {
+  using NodeAlloc = typename std::allocator_traits<
+      Alloc>::template rebind_alloc<Node<Tk, Tv>>;
+
 public:
-  AVLTree() {
+  AVLTree() : AVLTree(Alloc()) {}
+
+  explicit AVLTree(const Alloc &allocator)
+      : pool(memory::AllocSite::kAVLTree, NodeAlloc(allocator)) {
     root = nullptr;
     size = 0;
   }
 
   const Tv &operator[](const Tk &key) const {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
     if (node == nullptr) {
       throw std::runtime_error("Node with this key doesn't exists");
     } else {
@@ -257,15 +357,17 @@ public:
     }
   }
 
-  Tv &operator[](const Tk &key) {
-    auto node = Get(root, key);
-    if (node == nullptr) {
-      root = Insert(root, key, Tv());
+  Tv &operator[](const Tk &key) { return TryEmplace(key).first()->value; }
+
+  // Adds key with value unless key is already present. Returns the node for
+  // key either way, and whether it was added, after a single descent.
+  std::pair<AVLTreeIterator<Tk, Tv>, bool> TryEmplace(const Tk &key,
+                                                      const Tv &value = Tv()) {
+    const auto [node, inserted] = Insert(root, key, value, pool, less);
+    if (inserted) {
       ++size;
-      return Get(root, key)->value;
-    } else {
-      return node->value;
     }
+    return {AVLTreeIterator<Tk, Tv>(node), inserted};
   }
 
   AVLTreeIterator<Tk, Tv> Begin() {
@@ -279,47 +381,98 @@ public:
     return AVLTreeIterator(n);
   }
 
-  void Remove(const Tk &key) {
-    root = RemoveNode(root, key);
+  // Returns whether key was there to remove.
+  bool Remove(const Tk &key) {
+    auto node = Get(root, key, less);
+    if (node == nullptr) {
+      return false;
+    }
+    RemoveNode(node, root, pool);
     --size;
+    return true;
   }
 
   AVLTreeIterator<Tk, Tv> Find(const Tk &key) {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
     return AVLTreeIterator(node);
   }
 
   AVLTreeIterator<Tk, Tv> Find(const Tk &key) const {
-    auto node = Get(root, key);
+    auto node = Get(root, key, less);
+    return AVLTreeIterator(node);
+  }
+
+  // Lookups by any type Compare orders against Tk, without building a Tk.
+  template <typename K>
+    requires TransparentCompare<Compare>
+  AVLTreeIterator<Tk, Tv> Find(const K &key) const {
+    auto node = Get(root, key, less);
     return AVLTreeIterator(node);
   }
 
+  template <typename K>
+    requires TransparentCompare<Compare>
+  bool Remove(const K &key) {
+    auto node = Get(root, key, less);
+    if (node == nullptr) {
+      return false;
+    }
+    RemoveNode(node, root, pool);
+    --size;
+    return true;
+  }
+
+  // Replaces the contents with the (key, value) pairs in [first, last) in
+  // O(n), without a single comparison-driven descent or rotation. Keys must
+  // be strictly increasing; if they are not, returns false and leaves the
+  // tree as it was.
+  template <std::random_access_iterator It>
+  bool BuildFromSorted(It first, It last) {
+    const size_t count = last - first;
+    for (size_t i(1); i < count; ++i) {
+      if (!less(first[i - 1].first, first[i].first)) {
+        return false;
+      }
+    }
+    Clear();
+    try {
+      BuildBalanced(first, count, static_cast<Node<Tk, Tv> *>(nullptr), root,
+                    pool);
+    } catch (...) {
+      Clear();
+      throw;
+    }
+    size = count;
+    return true;
+  }
+
   ~AVLTree() { Clear(); }
 
   void Clear() {
-    Clear(root);
+    if constexpr (!std::is_trivially_destructible_v<Node<Tk, Tv>>) {
+      Destroy(root);
+    }
+    pool.Release();
     root = nullptr;
     size = 0;
   }
   size_t Size() { return size; }
 
 private:
-  void Clear(Node<Tk, Tv> *node) {
+  // Runs the node destructors only; the memory goes back with the slabs.
+  void Destroy(Node<Tk, Tv> *node) {
     if (!node) {
       return;
     }
-    if (node->left) {
-      Clear(node->left);
-    }
-    if (node->right) {
-      Clear(node->right);
-    }
-
-    delete node;
+    Destroy(node->left);
+    Destroy(node->right);
+    node->~Node();
   }
 
   Node<Tk, Tv> *root;
   size_t size;
+  [[no_unique_address]] Compare less;
+  memory::SlabPool<Node<Tk, Tv>, NodeAlloc> pool;
 };
 
 namespace avl_tree {
@@ -396,6 +549,114 @@ void Test() {
       }
     }
   } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    tools::memory::Arena arena(1 << 12, true);
+    using Alloc = tools::memory::ArenaAllocator<int>;
+    tools::containers::AVLTree<std::string, int, Alloc> tree{Alloc(arena)};
+    for (int i(0); i < 1000; ++i) {
+      tree[std::to_string(i)] = i;
+    }
+    for (int i(0); i < 1000; i += 2) {
+      tree.Remove(std::to_string(i));
+    }
+    const size_t reserved = arena.Reserved();
+    for (int i(0); i < 1000; i += 2) {
+      tree[std::to_string(i)] = i;
+    }
+    if (arena.Reserved() != reserved || tree.Size() != 1000) {
+      throw std::runtime_error("3");
+    }
+    for (int i(0); i < 1000; ++i) {
+      if (tree[std::to_string(i)] != i) {
+        throw std::runtime_error("4");
+      }
+    }
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    tools::containers::AVLTree<int, int> tree;
+    for (int i(0); i < 1000; ++i) {
+      const auto [it, inserted] = tree.TryEmplace(i * 7 % 1000, i);
+      if (!inserted || it()->key != i * 7 % 1000 || it()->value != i) {
+        throw std::runtime_error("5");
+      }
+    }
+    const auto [it, inserted] = tree.TryEmplace(7, -1);
+    if (inserted || it()->value != 1 || tree.Size() != 1000) {
+      throw std::runtime_error("6");
+    }
+    for (int i(0); i < 1000; i += 3) {
+      if (!tree.Remove(i) || tree.Remove(i)) {
+        throw std::runtime_error("7");
+      }
+    }
+    int prev = -1;
+    size_t count = 0;
+    for (auto it = tree.Begin(); it(); it.next(), ++count) {
+      if (it()->key <= prev || it()->key % 3 == 0) {
+        throw std::runtime_error("8");
+      }
+      prev = it()->key;
+    }
+    if (count != tree.Size() || count != 666) {
+      throw std::runtime_error("9");
+    }
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    tools::containers::AVLTree<std::string, int, std::allocator<int>,
+                               std::less<>>
+        tree;
+    for (int i(0); i < 100; ++i) {
+      tree[std::to_string(i)] = i;
+    }
+    const std::string_view key = "42";
+    if (!tree.Find(key)() || tree.Find(key)()->value != 42 ||
+        tree.Find(std::string_view("420"))()) {
+      throw std::runtime_error("10");
+    }
+    if (!tree.Remove(key) || tree.Remove("42") || tree.Size() != 99) {
+      throw std::runtime_error("11");
+    }
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    tools::containers::AVLTree<int, int> tree;
+    tree[-1] = -1;
+    std::vector<std::pair<int, int>> sorted;
+    for (int i(0); i < 1000; ++i) {
+      sorted.emplace_back(i * 2, i);
+    }
+    std::vector<std::pair<int, int>> unsorted = {{2, 0}, {1, 0}};
+    if (tree.BuildFromSorted(unsorted.begin(), unsorted.end()) ||
+        tree.Size() != 1) {
+      throw std::runtime_error("12");
+    }
+    if (!tree.BuildFromSorted(sorted.begin(), sorted.end()) ||
+        tree.Size() != 1000 || tree.Find(-1)() || tree[1998] != 999) {
+      throw std::runtime_error("13");
+    }
+    for (auto it = tree.Begin(); it(); it.next()) {
+      const auto *node = it();
+      const int hl = Height(node->left);
+      const int hr = Height(node->right);
+      if (node->height != (hl > hr ? hl : hr) + 1 || hl - hr > 1 ||
+          hr - hl > 1 || (node->left && node->left->parent != node)) {
+        throw std::runtime_error("13");
+      }
+    }
+    // The tree keeps working as usual afterwards.
+    for (int i(1); i < 2000; i += 2) {
+      tree[i] = i;
+    }
+    int expected = 0;
+    for (auto it = tree.Begin(); it(); it.next(), ++expected) {
+      if (it()->key != expected) {
+        throw std::runtime_error("14");
+      }
+    }
+  } /////////////////////////////////////////////////////////////////
 }
 #endif
 } // namespace avl_tree
@@ -0,0 +1,703 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "../memory/alloc_stats.hpp"
+#include "../memory/slab_pool.hpp"
+
+#ifdef DEBUG
+#include <cassert>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#endif
+
+namespace {
+constexpr const size_t kBTreeNodeBytes = 256;
+// Every node but the root has at least two children, so no tree that fits in
+// memory gets deeper than this.
+constexpr const size_t kBTreeMaxHeight = 64;
+} // namespace
+
+namespace tools::containers {
+namespace detail {
+
+template <typename Tk, typename Tv> struct BTreeSlot {
+  Tk key;
+  Tv value;
+};
+
+// Fanout that makes a node's slots span about kBTreeNodeBytes, four cache
+// lines, but never less than 3, the least that splits into two valid nodes.
+template <typename Tk, typename Tv> constexpr size_t BTreeFanout() {
+  constexpr size_t fit = kBTreeNodeBytes / sizeof(BTreeSlot<Tk, Tv>);
+  return fit < 3 ? 3 : fit;
+}
+
+template <typename Tk, typename Tv, size_t B> struct BTreeNode {
+  BTreeNode *parent;
+  // Index of this node among its parent's children.
+  uint16_t position;
+  uint16_t count;
+  bool leaf;
+  BTreeSlot<Tk, Tv> slots[B];
+
+  explicit BTreeNode(bool is_leaf) {
+    parent = nullptr;
+    position = count = 0;
+    leaf = is_leaf;
+  }
+};
+
+// Only internal nodes carry child pointers, so the leaves, which are most of
+// the nodes, stay as small as their slots allow.
+template <typename Tk, typename Tv, size_t B>
+struct BTreeInternal : BTreeNode<Tk, Tv, B> {
+  BTreeNode<Tk, Tv, B> *children[B + 1];
+
+  BTreeInternal() : BTreeNode<Tk, Tv, B>(false) {}
+};
+
+template <typename Tk, typename Tv, size_t B>
+BTreeNode<Tk, Tv, B> **Children(BTreeNode<Tk, Tv, B> *node) {
+  return static_cast<BTreeInternal<Tk, Tv, B> *>(node)->children;
+}
+
+} // namespace detail
+
+// Walks the slots in key order. Like AVLTreeIterator, operator() gives the
+// current entry (with ->key and ->value) or nullptr past the end. Any insert
+// or removal may move entries between nodes and invalidates iterators.
+template <typename Tk, typename Tv, size_t B> class BTreeIterator {
+public:
+  explicit BTreeIterator(detail::BTreeNode<Tk, Tv, B> *node, size_t at = 0) {
+    current = node;
+    index = at;
+  }
+
+  detail::BTreeSlot<Tk, Tv> *operator()() {
+    return current ? &current->slots[index] : nullptr;
+  }
+  const detail::BTreeSlot<Tk, Tv> *operator()() const {
+    return current ? &current->slots[index] : nullptr;
+  }
+
+  detail::BTreeSlot<Tk, Tv> *next() {
+    if (current == nullptr) {
+      return nullptr;
+    }
+    if (!current->leaf) {
+      // The successor is the first slot of the leftmost leaf to the right.
+      current = Children(current)[index + 1];
+      while (!current->leaf) {
+        current = Children(current)[0];
+      }
+      index = 0;
+      return &current->slots[index];
+    }
+    ++index;
+    while (index == current->count) {
+      if (current->parent == nullptr) {
+        current = nullptr;
+        return nullptr;
+      }
+      index = current->position;
+      current = current->parent;
+    }
+    return &current->slots[index];
+  }
+
+private:
+  detail::BTreeNode<Tk, Tv, B> *current;
+  size_t index;
+};
+
+// B-tree keeping up to B entries per node, with the same interface as
+// AVLTree so the two can be swapped by changing a type. A lookup reads one
+// node per level, a few cache lines that are scanned together, instead of
+// one scattered node per comparison: about log_{B/2}(n) misses against
+// AVLTree's 1.44 log_2(n). Leaves and internal nodes come from two
+// SlabPools.
+template <typename Tk, typename Tv, size_t B = detail::BTreeFanout<Tk, Tv>(),
+          typename Compare = std::less<Tk>>
+class BTree {
+  static_assert(B >= 3 && B < UINT16_MAX, "Unsupported node fanout");
+  static_assert(std::is_nothrow_move_assignable_v<Tk> &&
+                    std::is_nothrow_move_assignable_v<Tv>,
+                "Entries are moved between nodes after nodes are allocated");
+
+  using Node = detail::BTreeNode<Tk, Tv, B>;
+  using Internal = detail::BTreeInternal<Tk, Tv, B>;
+  using Slot = detail::BTreeSlot<Tk, Tv>;
+
+  // Fewest entries a node other than the root holds; splitting a full node
+  // leaves B / 2 and B - B / 2 - 1.
+  static constexpr size_t kMinSlots = (B - 1) / 2;
+
+public:
+  BTree()
+      : leaves(memory::AllocSite::kBTree),
+        internals(memory::AllocSite::kBTree) {
+    root = nullptr;
+    size = 0;
+  }
+
+  BTree(const BTree &) = delete;
+  BTree &operator=(const BTree &) = delete;
+
+  ~BTree() { Clear(); }
+
+  const Tv &operator[](const Tk &key) const {
+    auto [node, index] = Search(key);
+    if (node == nullptr) {
+      throw std::runtime_error("Node with this key doesn't exists");
+    }
+    return node->slots[index].value;
+  }
+
+  Tv &operator[](const Tk &key) { return TryEmplace(key).first()->value; }
+
+  // Adds key with value unless key is already present. Returns the entry for
+  // key either way, and whether it was added, after a single descent.
+  std::pair<BTreeIterator<Tk, Tv, B>, bool> TryEmplace(const Tk &key,
+                                                       const Tv &value = Tv()) {
+    if (root == nullptr) {
+      Slot slot{key, value};
+      root = NewLeaf();
+      Place(root, 0, std::move(slot), nullptr);
+      ++size;
+      return {BTreeIterator<Tk, Tv, B>(root), true};
+    }
+    Node *node = root;
+    while (true) {
+      const size_t i = LowerBound(node, key);
+      if (i < node->count && !less(key, node->slots[i].key)) {
+        return {BTreeIterator<Tk, Tv, B>(node, i), false};
+      }
+      if (node->leaf) {
+        const auto [at, index] = InsertSlot(node, i, Slot{key, value});
+        ++size;
+        return {BTreeIterator<Tk, Tv, B>(at, index), true};
+      }
+      node = Children(node)[i];
+    }
+  }
+
+  BTreeIterator<Tk, Tv, B> Begin() {
+    if (root == nullptr) {
+      return BTreeIterator<Tk, Tv, B>(nullptr);
+    }
+    Node *node = root;
+    while (!node->leaf) {
+      node = Children(node)[0];
+    }
+    return BTreeIterator<Tk, Tv, B>(node);
+  }
+
+  BTreeIterator<Tk, Tv, B> Find(const Tk &key) const {
+    const auto [node, index] = Search(key);
+    return BTreeIterator<Tk, Tv, B>(node, index);
+  }
+
+  // Lookups by any type Compare orders against Tk, without building a Tk.
+  template <typename K>
+    requires requires { typename Compare::is_transparent; }
+  BTreeIterator<Tk, Tv, B> Find(const K &key) const {
+    const auto [node, index] = Search(key);
+    return BTreeIterator<Tk, Tv, B>(node, index);
+  }
+
+  // Returns whether key was there to remove.
+  bool Remove(const Tk &key) { return RemoveKey(key); }
+
+  template <typename K>
+    requires requires { typename Compare::is_transparent; }
+  bool Remove(const K &key) {
+    return RemoveKey(key);
+  }
+
+  // Replaces the contents with the (key, value) pairs in [first, last) by
+  // appending each to the rightmost leaf, O(n) in total. Keys must be
+  // strictly increasing; if they are not, returns false and leaves the tree
+  // as it was.
+  template <std::random_access_iterator It>
+  bool BuildFromSorted(It first, It last) {
+    const size_t count = last - first;
+    for (size_t i(1); i < count; ++i) {
+      if (!less(first[i - 1].first, first[i].first)) {
+        return false;
+      }
+    }
+    Clear();
+    try {
+      Node *tail = nullptr;
+      for (size_t i(0); i < count; ++i) {
+        if (tail == nullptr) {
+          tail = root = NewLeaf();
+        }
+        tail = InsertSlot(tail, tail->count,
+                          Slot{first[i].first, first[i].second})
+                   .first;
+        ++size;
+      }
+    } catch (...) {
+      Clear();
+      throw;
+    }
+    return true;
+  }
+
+  void Clear() {
+    if (root != nullptr) {
+      if constexpr (!std::is_trivially_destructible_v<Slot>) {
+        Destroy(root);
+      }
+    }
+    leaves.Release();
+    internals.Release();
+    root = nullptr;
+    size = 0;
+  }
+
+  size_t Size() { return size; }
+
+#ifdef DEBUG
+
+  // Checks the B-tree invariants: order within and across nodes, occupancy,
+  // parent links and equal depth of all leaves.
+  void Validate() {
+    size_t depth = 0;
+    for (Node *node = root; node != nullptr && !node->leaf;
+         node = Children(node)[0]) {
+      ++depth;
+    }
+    assert(root == nullptr || root->parent == nullptr);
+    assert(Validate(root, 0, depth, nullptr, nullptr) == size);
+  }
+
+#endif
+
+private:
+  // Index of the first slot in node whose key is not less than key. A node
+  // spans a few cache lines, so the binary search costs no extra misses.
+  template <typename K>
+  size_t LowerBound(const Node *node, const K &key) const {
+    size_t lo = 0;
+    size_t hi = node->count;
+    while (lo < hi) {
+      const size_t mid = (lo + hi) / 2;
+      if (less(node->slots[mid].key, key)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  template <typename K>
+  std::pair<Node *, size_t> Search(const K &key) const {
+    Node *node = root;
+    while (node != nullptr) {
+      const size_t i = LowerBound(node, key);
+      if (i < node->count && !less(key, node->slots[i].key)) {
+        return {node, i};
+      }
+      if (node->leaf) {
+        break;
+      }
+      node = Children(node)[i];
+    }
+    return {nullptr, 0};
+  }
+
+  template <typename K> bool RemoveKey(const K &key) {
+    auto [node, index] = Search(key);
+    if (node == nullptr) {
+      return false;
+    }
+    if (!node->leaf) {
+      // Take the predecessor's place; it is the last entry of a leaf.
+      Node *leaf = Children(node)[index];
+      while (!leaf->leaf) {
+        leaf = Children(leaf)[leaf->count];
+      }
+      node->slots[index] = std::move(leaf->slots[leaf->count - 1]);
+      node = leaf;
+      index = leaf->count - 1;
+    }
+    for (size_t i(index + 1); i < node->count; ++i) {
+      node->slots[i - 1] = std::move(node->slots[i]);
+    }
+    --node->count;
+    --size;
+    Rebalance(node);
+    return true;
+  }
+
+  Node *NewLeaf() {
+    Node *node = leaves.Allocate();
+    try {
+      new (node) Node(true);
+    } catch (...) {
+      leaves.Deallocate(node);
+      throw;
+    }
+    return node;
+  }
+
+  Node *NewInternal() {
+    Internal *node = internals.Allocate();
+    try {
+      new (node) Internal();
+    } catch (...) {
+      internals.Deallocate(node);
+      throw;
+    }
+    return node;
+  }
+
+  void DeleteNode(Node *node) {
+    if (node->leaf) {
+      node->~Node();
+      leaves.Deallocate(node);
+    } else {
+      auto *internal = static_cast<Internal *>(node);
+      internal->~Internal();
+      internals.Deallocate(internal);
+    }
+  }
+
+  // Puts child at index i of node's children and fixes its back links.
+  static void SetChild(Node *node, size_t i, Node *child) {
+    Children(node)[i] = child;
+    child->parent = node;
+    child->position = static_cast<uint16_t>(i);
+  }
+
+  // Inserts slot at index i of a node with room; right is the child that
+  // follows it, for internal nodes.
+  static void Place(Node *node, size_t i, Slot &&slot, Node *right) {
+    for (size_t k(node->count); k > i; --k) {
+      node->slots[k] = std::move(node->slots[k - 1]);
+    }
+    node->slots[i] = std::move(slot);
+    if (!node->leaf) {
+      for (size_t k(node->count + 1); k > i + 1; --k) {
+        SetChild(node, k, Children(node)[k - 1]);
+      }
+      SetChild(node, i + 1, right);
+    }
+    ++node->count;
+  }
+
+  // Inserts slot at index i of node, splitting full nodes on the way up, and
+  // returns where it ended up. The siblings those splits need, and a new
+  // root, are allocated before anything moves, so a failed allocation leaves
+  // the tree as it was.
+  std::pair<Node *, size_t> InsertSlot(Node *node, size_t i, Slot &&slot) {
+    Node *spare[kBTreeMaxHeight + 1];
+    size_t spares = 0;
+    try {
+      Node *full = node;
+      for (; full != nullptr && full->count == B; full = full->parent) {
+        spare[spares++] = full->leaf ? NewLeaf() : NewInternal();
+      }
+      if (full == nullptr && spares > 0) {
+        spare[spares++] = NewInternal();
+      }
+    } catch (...) {
+      while (spares > 0) {
+        DeleteNode(spare[--spares]);
+      }
+      throw;
+    }
+
+    std::pair<Node *, size_t> at = {nullptr, 0};
+    Node *right = nullptr;
+    for (size_t used(0);; ++used) {
+      if (node->count < B) {
+        Place(node, i, std::move(slot), right);
+        return at.first ? at : std::pair<Node *, size_t>(node, i);
+      }
+      // node keeps [0, mid), the sibling takes (mid, B) and slots[mid] moves
+      // up; the new slot joins whichever half it sorts into.
+      const size_t mid = B / 2;
+      Node *sibling = spare[used];
+      for (size_t k(mid + 1); k < B; ++k) {
+        sibling->slots[k - mid - 1] = std::move(node->slots[k]);
+      }
+      if (!node->leaf) {
+        for (size_t k(mid + 1); k <= B; ++k) {
+          SetChild(sibling, k - mid - 1, Children(node)[k]);
+        }
+      }
+      sibling->count = static_cast<uint16_t>(B - mid - 1);
+      Slot median = std::move(node->slots[mid]);
+      node->count = static_cast<uint16_t>(mid);
+
+      Node *target = i <= mid ? node : sibling;
+      const size_t index = i <= mid ? i : i - mid - 1;
+      Place(target, index, std::move(slot), right);
+      if (at.first == nullptr) {
+        at = {target, index};
+      }
+
+      if (node->parent == nullptr) {
+        Node *top = spare[used + 1];
+        SetChild(top, 0, node);
+        Place(top, 0, std::move(median), sibling);
+        root = top;
+        return at;
+      }
+      i = node->position;
+      slot = std::move(median);
+      right = sibling;
+      node = node->parent;
+    }
+  }
+
+  // Restores occupancy after node lost an entry: borrow from a sibling
+  // through the parent if one can spare it, otherwise merge with one, which
+  // takes an entry from the parent and may cascade upward.
+  void Rebalance(Node *node) {
+    while (node != root && node->count < kMinSlots) {
+      Node *parent = node->parent;
+      const size_t pos = node->position;
+      Node **siblings = Children(parent);
+      if (pos > 0 && siblings[pos - 1]->count > kMinSlots) {
+        RotateRight(parent, pos - 1);
+        return;
+      }
+      if (pos < parent->count && siblings[pos + 1]->count > kMinSlots) {
+        RotateLeft(parent, pos);
+        return;
+      }
+      Merge(parent, pos > 0 ? pos - 1 : pos);
+      node = parent;
+    }
+    if (root->count == 0) {
+      Node *old = root;
+      root = root->leaf ? nullptr : Children(root)[0];
+      if (root != nullptr) {
+        root->parent = nullptr;
+        root->position = 0;
+      }
+      DeleteNode(old);
+    }
+  }
+
+  // Moves the separator at parent->slots[i] down into the right child and
+  // the left child's last entry up in its place.
+  static void RotateRight(Node *parent, size_t i) {
+    Node *left = Children(parent)[i];
+    Node *right = Children(parent)[i + 1];
+    for (size_t k(right->count); k > 0; --k) {
+      right->slots[k] = std::move(right->slots[k - 1]);
+    }
+    right->slots[0] = std::move(parent->slots[i]);
+    parent->slots[i] = std::move(left->slots[left->count - 1]);
+    if (!right->leaf) {
+      for (size_t k(right->count + 1); k > 0; --k) {
+        SetChild(right, k, Children(right)[k - 1]);
+      }
+      SetChild(right, 0, Children(left)[left->count]);
+    }
+    --left->count;
+    ++right->count;
+  }
+
+  // Mirror of RotateRight: the right child's first entry goes up.
+  static void RotateLeft(Node *parent, size_t i) {
+    Node *left = Children(parent)[i];
+    Node *right = Children(parent)[i + 1];
+    left->slots[left->count] = std::move(parent->slots[i]);
+    parent->slots[i] = std::move(right->slots[0]);
+    for (size_t k(1); k < right->count; ++k) {
+      right->slots[k - 1] = std::move(right->slots[k]);
+    }
+    if (!left->leaf) {
+      SetChild(left, left->count + 1, Children(right)[0]);
+      for (size_t k(1); k <= right->count; ++k) {
+        SetChild(right, k - 1, Children(right)[k]);
+      }
+    }
+    ++left->count;
+    --right->count;
+  }
+
+  // Folds the separator parent->slots[i] and the right child into the left
+  // one. Only called when both together fit: one is below kMinSlots and the
+  // other at it.
+  void Merge(Node *parent, size_t i) {
+    Node *left = Children(parent)[i];
+    Node *right = Children(parent)[i + 1];
+    const size_t base = left->count;
+    left->slots[base] = std::move(parent->slots[i]);
+    for (size_t k(0); k < right->count; ++k) {
+      left->slots[base + 1 + k] = std::move(right->slots[k]);
+    }
+    if (!left->leaf) {
+      for (size_t k(0); k <= right->count; ++k) {
+        SetChild(left, base + 1 + k, Children(right)[k]);
+      }
+    }
+    left->count = static_cast<uint16_t>(base + 1 + right->count);
+
+    for (size_t k(i + 1); k < parent->count; ++k) {
+      parent->slots[k - 1] = std::move(parent->slots[k]);
+    }
+    for (size_t k(i + 2); k <= parent->count; ++k) {
+      SetChild(parent, k - 1, Children(parent)[k]);
+    }
+    --parent->count;
+    DeleteNode(right);
+  }
+
+  // Runs the node destructors only; the memory goes back with the slabs.
+  void Destroy(Node *node) {
+    if (node->leaf) {
+      node->~Node();
+      return;
+    }
+    for (size_t k(0); k <= node->count; ++k) {
+      Destroy(Children(node)[k]);
+    }
+    static_cast<Internal *>(node)->~Internal();
+  }
+
+#ifdef DEBUG
+
+  // Returns the number of entries under node.
+  size_t Validate(Node *node, size_t level, size_t depth, const Tk *lo,
+                  const Tk *hi) {
+    if (node == nullptr) {
+      return 0;
+    }
+    assert(node == root || node->count >= kMinSlots);
+    assert(node->count <= B && (node->leaf == (level == depth)));
+    for (size_t k(0); k < node->count; ++k) {
+      const Tk &key = node->slots[k].key;
+      assert(k == 0 || less(node->slots[k - 1].key, key));
+      assert(lo == nullptr || less(*lo, key));
+      assert(hi == nullptr || less(key, *hi));
+    }
+    size_t total = node->count;
+    if (!node->leaf) {
+      for (size_t k(0); k <= node->count; ++k) {
+        Node *child = Children(node)[k];
+        assert(child->parent == node && child->position == k);
+        total += Validate(child, level + 1, depth,
+                          k == 0 ? lo : &node->slots[k - 1].key,
+                          k == node->count ? hi : &node->slots[k].key);
+      }
+    }
+    return total;
+  }
+
+#endif
+
+  Node *root;
+  size_t size;
+  [[no_unique_address]] Compare less;
+  memory::SlabPool<Node> leaves;
+  memory::SlabPool<Internal> internals;
+};
+
+#ifdef DEBUG
+
+namespace btree_test {
+
+// Random inserts and removals against std::map, with B small enough that
+// every split, borrow and merge path runs many times.
+template <size_t B> void Churn() {
+  BTree<int, int, B> tree;
+  std::map<int, int> expected;
+  std::mt19937 rng(B);
+  for (int i(0); i < 200000; ++i) {
+    const int key = static_cast<int>(rng() % 5000);
+    if (rng() % 2) {
+      [[maybe_unused]] const bool added = tree.TryEmplace(key, i).second;
+      assert(added == expected.emplace(key, i).second);
+    } else {
+      assert(tree.Remove(key) == (expected.erase(key) == 1));
+    }
+    if (i % 10000 == 0) {
+      tree.Validate();
+    }
+  }
+  tree.Validate();
+  assert(tree.Size() == expected.size());
+  auto it = tree.Begin();
+  for ([[maybe_unused]] const auto &[key, value] : expected) {
+    assert(it() && it()->key == key && it()->value == value);
+    it.next();
+  }
+  assert(it() == nullptr);
+  for ([[maybe_unused]] const auto &[key, value] : expected) {
+    assert(tree.Find(key)()->value == value && tree[key] == value);
+    assert(tree.Remove(key));
+  }
+  tree.Validate();
+  assert(tree.Size() == 0 && tree.Begin()() == nullptr);
+}
+
+void Test() {
+  Churn<3>();
+  Churn<4>();
+  Churn<5>();
+  Churn<detail::BTreeFanout<int, int>()>();
+
+  {
+    BTree<std::string, int, detail::BTreeFanout<std::string, int>(),
+          std::less<>>
+        tree;
+    for (int i(0); i < 1000; ++i) {
+      tree[std::to_string(i)] = i;
+    }
+    [[maybe_unused]] const std::string_view key = "42";
+    assert(tree.Find(key)()->value == 42);
+    assert(tree.Find(std::string_view("420"))()->value == 420);
+    assert(tree.Find(std::string_view("x"))() == nullptr);
+    assert(tree.Remove(key) && !tree.Remove("42") && tree.Size() == 999);
+    tree.Validate();
+  }
+
+  {
+    BTree<int, int, 4> tree;
+    tree[-1] = -1;
+    std::vector<std::pair<int, int>> sorted;
+    for (int i(0); i < 1000; ++i) {
+      sorted.emplace_back(i * 2, i);
+    }
+    std::vector<std::pair<int, int>> unsorted = {{2, 0}, {1, 0}};
+    assert(!tree.BuildFromSorted(unsorted.begin(), unsorted.end()));
+    assert(tree.Size() == 1 && tree[-1] == -1);
+    assert(tree.BuildFromSorted(sorted.begin(), sorted.end()));
+    tree.Validate();
+    assert(tree.Size() == 1000 && !tree.Find(-1)() && tree[1998] == 999);
+    for (int i(1); i < 2000; i += 2) {
+      tree[i] = i;
+    }
+    tree.Validate();
+    int expected = 0;
+    for (auto it = tree.Begin(); it(); it.next(), ++expected) {
+      assert(it()->key == expected);
+    }
+    assert(expected == 2000);
+  }
+}
+
+} // namespace btree_test
+
+#endif
+
+} // namespace tools::containers
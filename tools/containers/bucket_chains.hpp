@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "vector.hpp"
+
+namespace {
+constexpr const uint32_t kBucketFirstChunk = 2;
+constexpr const uint32_t kBucketMaxChunk = 256;
+constexpr const size_t kBucketSegmentBits = 16;
+constexpr const size_t kBucketSegmentSize = size_t(1) << kBucketSegmentBits;
+} // namespace
+
+namespace tools::containers {
+
+// Values grouped by a bounded key, appended in O(1) with no histogram or
+// scatter pass. Every key owns a chain of chunks carved out of fixed-size
+// segments that are never moved or copied; chunk capacities double along a
+// chain, so rare keys waste little and frequent ones are read mostly
+// sequentially. ForEach visits keys in increasing order and the values of a
+// key in insertion order.
+template <typename T> class BucketChains {
+public:
+  explicit BucketChains(size_t keys)
+      : heads_(keys, kNoChunk), tails_(keys, kNoChunk) {}
+
+  [[nodiscard]] size_t Keys() const noexcept { return heads_.Size(); }
+
+  void PushBack(size_t key, const T &value) {
+    uint32_t tail = tails_[key];
+    if (tail == kNoChunk || chunks_[tail].size == chunks_[tail].capacity) {
+      tail = NewChunk(key, tail);
+    }
+    Chunk &chunk = chunks_[tail];
+    Item(chunk.begin + chunk.size++) = value;
+  }
+
+  template <typename Fn> void ForEach(Fn visit) const {
+    for (size_t key(0); key < heads_.Size(); ++key) {
+      for (uint32_t c = heads_[key]; c != kNoChunk; c = chunks_[c].next) {
+        const Chunk &chunk = chunks_[c];
+        for (uint32_t i(0); i < chunk.size; ++i) {
+          visit(key, Item(chunk.begin + i));
+        }
+      }
+    }
+  }
+
+private:
+  static constexpr const uint32_t kNoChunk = UINT32_MAX;
+
+  struct Chunk {
+    size_t begin;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t next;
+  };
+
+  uint32_t NewChunk(size_t key, uint32_t tail) {
+    const uint32_t capacity =
+        tail == kNoChunk
+            ? kBucketFirstChunk
+            : std::min(kBucketMaxChunk, 2 * chunks_[tail].capacity);
+    if ((items_ + capacity - 1) >> kBucketSegmentBits !=
+        items_ >> kBucketSegmentBits) {
+      items_ = ((items_ >> kBucketSegmentBits) + 1) << kBucketSegmentBits;
+    }
+    if ((items_ >> kBucketSegmentBits) == segments_.Size()) {
+      segments_.PushBack(std::make_shared<T[]>(kBucketSegmentSize));
+    }
+    const auto index = static_cast<uint32_t>(chunks_.Size());
+    chunks_.PushBack({items_, 0, capacity, kNoChunk});
+    items_ += capacity;
+    if (tail == kNoChunk) {
+      heads_[key] = index;
+    } else {
+      chunks_[tail].next = index;
+    }
+    tails_[key] = index;
+    return index;
+  }
+
+  T &Item(size_t i) const {
+    return segments_[i >> kBucketSegmentBits][i & (kBucketSegmentSize - 1)];
+  }
+
+  Vector<std::shared_ptr<T[]>> segments_;
+  size_t items_ = 0;
+  Vector<Chunk> chunks_;
+  Vector<uint32_t> heads_;
+  Vector<uint32_t> tails_;
+};
+
+#ifdef DEBUG
+
+namespace bucket_chains_test {
+
+void Test() {
+  BucketChains<int> buckets(4);
+  const std::vector<std::pair<size_t, int>> input = {
+      {3, 0}, {1, 1}, {3, 2}, {1, 3}, {1, 4}, {1, 5}, {0, 6}, {1, 7}};
+  for (const auto &[key, value] : input) {
+    buckets.PushBack(key, value);
+  }
+
+  const std::vector<std::pair<size_t, int>> expected = {
+      {0, 6}, {1, 1}, {1, 3}, {1, 4}, {1, 5}, {1, 7}, {3, 0}, {3, 2}};
+  std::vector<std::pair<size_t, int>> got;
+  buckets.ForEach(
+      [&got](size_t key, int value) { got.emplace_back(key, value); });
+  assert(got == expected);
+}
+
+} // namespace bucket_chains_test
+
+#endif
+
+} // namespace tools::containers
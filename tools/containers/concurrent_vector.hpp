@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "../memory/alloc_stats.hpp"
+#include "vector.hpp"
+#include "vector_tools.hpp"
+
+namespace {
+constexpr const size_t kConcurrentFirstSegmentBits = 10;
+constexpr const size_t kConcurrentMaxSegments = 48;
+} // namespace
+
+namespace tools::containers {
+
+// Append-only vector that any number of threads may push into at once.
+// PushBack claims an index with one fetch_add and constructs the element in
+// place; storage is a list of segments, segment s holding
+// 2^(kConcurrentFirstSegmentBits + s) elements, that are allocated once and
+// never move. A pointer or reference to an element therefore stays valid
+// for the life of the vector, while other threads keep pushing.
+//
+// Size() counts claimed slots. Element i may be read once the PushBack that
+// returned i happened-before the read (the same thread, or after joining
+// the writer); Size() alone does not tell that the element is built.
+template <typename T> class ConcurrentVector {
+  static_assert(std::is_nothrow_move_constructible_v<T>,
+                "Elements are moved into their slot after it is claimed");
+
+public:
+  ConcurrentVector() = default;
+  ConcurrentVector(const ConcurrentVector &) = delete;
+  ConcurrentVector &operator=(const ConcurrentVector &) = delete;
+
+  ~ConcurrentVector() {
+    const size_t size = Size();
+    for (size_t s(0); s < kConcurrentMaxSegments; ++s) {
+      T *segment = segments_[s].load(std::memory_order_acquire);
+      if (segment == nullptr) {
+        continue;
+      }
+      const size_t begin = SegmentBegin(s);
+      const size_t end = std::min(size, begin + SegmentSize(s));
+      for (size_t i(begin); i < end; ++i) {
+        segment[i - begin].~T();
+      }
+      memory::RecordDeallocation(memory::AllocSite::kVector,
+                                 SegmentSize(s) * sizeof(T));
+      ::operator delete(segment, std::align_val_t(alignof(T)));
+    }
+  }
+
+  // Returns the index of the new element. The value is built before a slot
+  // is claimed, so a throwing constructor leaves the vector unchanged.
+  size_t PushBack(const T &elem) { return EmplaceBack(elem); }
+
+  size_t PushBack(T &&elem) { return EmplaceBack(std::move(elem)); }
+
+  template <typename... Args> size_t EmplaceBack(Args &&...args) {
+    T value(std::forward<Args>(args)...);
+    const size_t index = size_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= Capacity()) {
+      throw std::length_error("ConcurrentVector is full");
+    }
+    new (Slot(index)) T(std::move(value));
+    return index;
+  }
+
+  T &operator[](size_t n) {
+    if (n >= Size()) {
+      throw std::range_error("");
+    }
+    return *Slot(n);
+  }
+
+  const T &operator[](size_t n) const {
+    if (n >= Size()) {
+      throw std::range_error("");
+    }
+    return *Slot(n);
+  }
+
+  [[nodiscard]] size_t Size() const noexcept {
+    return std::min(size_.load(std::memory_order_acquire), Capacity());
+  }
+
+  // Calls fn(data, count) for the contiguous runs of [0, Size()) in index
+  // order, so bulk passes need one division of the index space per segment
+  // instead of one per element.
+  template <typename Fn> void ForEachSegment(Fn fn) const {
+    const size_t size = Size();
+    for (size_t s(0); s < kConcurrentMaxSegments; ++s) {
+      const size_t begin = SegmentBegin(s);
+      if (begin >= size) {
+        break;
+      }
+      fn(static_cast<const T *>(segments_[s].load(std::memory_order_acquire)),
+         std::min(size - begin, SegmentSize(s)));
+    }
+  }
+
+private:
+  static constexpr size_t Capacity() {
+    return SegmentBegin(kConcurrentMaxSegments);
+  }
+
+  static constexpr size_t SegmentSize(size_t s) {
+    return size_t(1) << (kConcurrentFirstSegmentBits + s);
+  }
+
+  // Index of the first element of segment s.
+  static constexpr size_t SegmentBegin(size_t s) {
+    return ((size_t(1) << s) - 1) << kConcurrentFirstSegmentBits;
+  }
+
+  static size_t SegmentOf(size_t index) {
+    return std::bit_width((index >> kConcurrentFirstSegmentBits) + 1) - 1;
+  }
+
+  T *Slot(size_t index) const {
+    const size_t s = SegmentOf(index);
+    return Segment(s) + (index - SegmentBegin(s));
+  }
+
+  // Threads that race for a missing segment each allocate one and the first
+  // to publish it wins. Running out of memory here is fatal: other threads
+  // may already have claimed slots in the segment.
+  T *Segment(size_t s) const noexcept {
+    T *segment = segments_[s].load(std::memory_order_acquire);
+    if (segment != nullptr) {
+      return segment;
+    }
+    const size_t bytes = SegmentSize(s) * sizeof(T);
+    T *fresh = static_cast<T *>(
+        ::operator new(bytes, std::align_val_t(alignof(T))));
+    if (segments_[s].compare_exchange_strong(segment, fresh,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+      memory::RecordAllocation(memory::AllocSite::kVector, bytes);
+      return fresh;
+    }
+    ::operator delete(fresh, std::align_val_t(alignof(T)));
+    return segment;
+  }
+
+  mutable std::atomic<T *> segments_[kConcurrentMaxSegments] = {};
+  std::atomic<size_t> size_ = 0;
+};
+
+namespace vector_tools {
+
+// Index sort straight over the segments: only (key, index) entries are
+// built, the records stay where the parser threads put them.
+template <typename T, KeyExtractor<T> Fn>
+Vector<KeyIndex> SortedKeyIndex(const ConcurrentVector<T> &v, const Fn &GetVal,
+                                size_t threads = 1) {
+  if (v.Size() > UINT32_MAX) {
+    throw std::length_error("Too many elements for 32-bit indices");
+  }
+  Vector<KeyIndex> order(v.Size());
+  KeyIndex *entries = order.Data();
+  uint32_t index = 0;
+  v.ForEachSegment([&](const T *data, size_t count) {
+    for (size_t i(0); i < count; ++i, ++index) {
+      entries[index] = {GetVal(data[i]), index};
+    }
+  });
+  LinearStableSort(order, KeyOfIndex(), threads);
+  return order;
+}
+
+} // namespace vector_tools
+
+#ifdef DEBUG
+
+namespace concurrent_vector_test {
+
+void Test() {
+  {
+    ConcurrentVector<std::string> v;
+    [[maybe_unused]] const std::string *first = &v[v.PushBack("first")];
+    for (int i(1); i < 5000; ++i) {
+      v.EmplaceBack(std::to_string(i));
+    }
+    // Growth never moves existing elements.
+    assert(first == &v[0] && *first == "first");
+    assert(v.Size() == 5000 && v[4999] == "4999");
+    size_t seen = 0;
+    v.ForEachSegment([&]([[maybe_unused]] const std::string *data,
+                         size_t count) {
+      for (size_t i(0); i < count; ++i, ++seen) {
+        assert(seen == 0 || data[i] == std::to_string(seen));
+      }
+    });
+    assert(seen == 5000);
+  }
+  {
+    constexpr const size_t kThreads = 4;
+    constexpr const size_t kPerThread = 50000;
+    ConcurrentVector<std::pair<size_t, size_t>> v;
+    std::thread writers[kThreads];
+    for (size_t t(0); t < kThreads; ++t) {
+      writers[t] = std::thread([&v, t] {
+        for (size_t i(0); i < kPerThread; ++i) {
+          v.PushBack({i % 1000, t * kPerThread + i});
+        }
+      });
+    }
+    for (auto &writer : writers) {
+      writer.join();
+    }
+    assert(v.Size() == kThreads * kPerThread);
+
+    const auto order = vector_tools::SortedKeyIndex<std::pair<size_t, size_t>>(
+        v, [](const std::pair<size_t, size_t> &p) { return p.first; });
+    Vector<bool> found(v.Size(), false);
+    for (size_t i(0); i < order.Size(); ++i) {
+      const auto &p = v[order[i].index];
+      assert(order[i].key == p.first);
+      assert(i == 0 || order[i - 1].key < order[i].key ||
+             order[i - 1].index < order[i].index);
+      found[p.second] = true;
+    }
+    for (size_t i(0); i < found.Size(); ++i) {
+      assert(found[i]);
+    }
+  }
+}
+
+} // namespace concurrent_vector_test
+
+#endif
+
+} // namespace tools::containers
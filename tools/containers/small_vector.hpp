@@ -0,0 +1,385 @@
+#pragma once
+#include <initializer_list>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../memory/alloc_stats.hpp"
+#include "vector.hpp"
+
+namespace tools::containers {
+
+// Vector with room for N elements inside the object itself: it touches the
+// heap only once it grows past N, so small short-lived collections cost no
+// allocations at all. Going back under N does not return to the inline
+// buffer.
+template <typename T, size_t N> class SmallVector {
+  static_assert(N > 0, "SmallVector needs a non-empty inline buffer");
+
+public:
+  SmallVector() = default;
+
+  explicit SmallVector(size_t size) : SmallVector() { Resize(size); }
+
+  SmallVector(size_t size, const T &default_value) : SmallVector() {
+    Resize(size, default_value);
+  }
+
+  SmallVector(std::initializer_list<T> list) : SmallVector() {
+    Reserve(list.size());
+    for (const T &el : list) {
+      new (data_ + size_) T(el);
+      ++size_;
+    }
+  }
+
+  SmallVector(const SmallVector &v) : SmallVector() {
+    Reserve(v.size_);
+    for (; size_ < v.size_; ++size_) {
+      new (data_ + size_) T(v.data_[size_]);
+    }
+  }
+
+  // A heap buffer is stolen as is; inline elements have to be moved one by
+  // one.
+  SmallVector(SmallVector &&v) noexcept(
+      std::is_nothrow_move_constructible_v<T>)
+      : SmallVector() {
+    Steal(v);
+  }
+
+  void PushBack(const T &elem) { EmplaceBack(elem); }
+
+  void PushBack(T &&elem) { EmplaceBack(std::move(elem)); }
+
+  // Same contract as Vector::EmplaceBack: the new element is built before the
+  // old ones are relocated.
+  template <typename... Args> T &EmplaceBack(Args &&...args) {
+    if (size_ < capacity_) {
+      new (data_ + size_) T(std::forward<Args>(args)...);
+      return data_[size_++];
+    }
+    const size_t capacity = capacity_ * kArrayResizeK;
+    T *new_data = Allocate(capacity);
+    try {
+      new (new_data + size_) T(std::forward<Args>(args)...);
+    } catch (...) {
+      Deallocate(new_data, capacity);
+      throw;
+    }
+    try {
+      Relocate(new_data, capacity);
+    } catch (...) {
+      new_data[size_].~T();
+      Deallocate(new_data, capacity);
+      throw;
+    }
+    return data_[size_++];
+  }
+
+  void Reserve(size_t capacity) {
+    if (capacity > capacity_) {
+      Reallocate(RoundCapacity(capacity));
+    }
+  }
+
+  void Resize(size_t size) {
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T();
+    }
+    Shrink(size);
+  }
+
+  void Resize(size_t size, const T &default_value) {
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T(default_value);
+    }
+    Shrink(size);
+  }
+
+  ~SmallVector() {
+    Shrink(0);
+    if (!IsInline()) {
+      Deallocate(data_, capacity_);
+    }
+  }
+
+  T &operator[](size_t n) {
+    if (n >= size_) {
+      throw std::range_error("");
+    }
+    return data_[n];
+  }
+
+  const T &operator[](size_t n) const {
+    if (n >= size_) {
+      throw std::range_error("");
+    }
+    return data_[n];
+  }
+
+  T &At(size_t n) {
+    if (n >= size_) {
+      throw std::range_error("");
+    }
+    return data_[n];
+  }
+
+  [[nodiscard]] const T &At(size_t n) const {
+    if (n >= size_) {
+      throw std::range_error("");
+    }
+    return data_[n];
+  }
+
+  SmallVector &operator=(const SmallVector &x) {
+    if (this == &x)
+      return *this;
+
+    SmallVector copy(x);
+    return *this = std::move(copy);
+  }
+
+  SmallVector &operator=(SmallVector &&x) noexcept(
+      std::is_nothrow_move_constructible_v<T>) {
+    if (this == &x)
+      return *this;
+
+    Shrink(0);
+    if (!IsInline()) {
+      Deallocate(data_, capacity_);
+      data_ = InlineData();
+      capacity_ = N;
+    }
+    Steal(x);
+    return *this;
+  }
+
+  [[nodiscard]] size_t Size() const noexcept { return size_; }
+  [[nodiscard]] size_t Capacity() const noexcept { return capacity_; };
+  T *Data() noexcept { return data_; }
+  const T *Data() const noexcept { return data_; }
+  [[nodiscard]] bool IsInline() const noexcept {
+    return data_ == InlineData();
+  }
+
+private:
+  static T *Allocate(size_t capacity) {
+    T *data = static_cast<T *>(
+        ::operator new(capacity * sizeof(T), std::align_val_t(alignof(T))));
+    memory::RecordAllocation(memory::AllocSite::kSmallVector,
+                             capacity * sizeof(T));
+    return data;
+  }
+
+  static void Deallocate(T *data, size_t capacity) noexcept {
+    memory::RecordDeallocation(memory::AllocSite::kSmallVector,
+                               capacity * sizeof(T));
+    ::operator delete(data, std::align_val_t(alignof(T)));
+  }
+
+  static size_t RoundCapacity(size_t capacity) {
+    size_t res = N;
+    while (res < capacity) {
+      res *= kArrayResizeK;
+    }
+    return res;
+  }
+
+  T *InlineData() noexcept { return reinterpret_cast<T *>(inline_); }
+  const T *InlineData() const noexcept {
+    return reinterpret_cast<const T *>(inline_);
+  }
+
+  // Expects this vector to be empty and inline.
+  void Steal(SmallVector &v) {
+    if (!v.IsInline()) {
+      data_ = v.data_;
+      size_ = v.size_;
+      capacity_ = v.capacity_;
+      v.data_ = v.InlineData();
+      v.size_ = 0;
+      v.capacity_ = N;
+      return;
+    }
+    for (; size_ < v.size_; ++size_) {
+      new (data_ + size_) T(std::move(v.data_[size_]));
+    }
+    v.Shrink(0);
+  }
+
+  void Relocate(T *new_data, size_t capacity) {
+    size_t i(0);
+    try {
+      for (; i < size_; ++i) {
+        new (new_data + i) T(std::move_if_noexcept(data_[i]));
+      }
+    } catch (...) {
+      while (i > 0) {
+        new_data[--i].~T();
+      }
+      throw;
+    }
+    for (i = 0; i < size_; ++i) {
+      data_[i].~T();
+    }
+    if (!IsInline()) {
+      memory::RecordReallocation(memory::AllocSite::kSmallVector);
+      Deallocate(data_, capacity_);
+    }
+    data_ = new_data;
+    capacity_ = capacity;
+  }
+
+  void Reallocate(size_t capacity) {
+    T *new_data = Allocate(capacity);
+    try {
+      Relocate(new_data, capacity);
+    } catch (...) {
+      Deallocate(new_data, capacity);
+      throw;
+    }
+  }
+
+  void Shrink(size_t size) noexcept {
+    while (size_ > size) {
+      data_[--size_].~T();
+    }
+  }
+
+  alignas(T) unsigned char inline_[N * sizeof(T)];
+  T *data_ = InlineData();
+  size_t size_ = 0;
+  size_t capacity_ = N;
+};
+
+template <typename T, size_t N>
+std::ostream &operator<<(std::ostream &os, const SmallVector<T, N> &v) {
+  os << "{ ";
+  for (size_t i(0); i < v.Size(); ++i) {
+    os << v[i] << (i + 1 == v.Size() ? "" : ", ");
+  }
+  os << " }";
+  return os;
+}
+
+#ifdef DEBUG
+
+namespace small_vector_test {
+
+namespace {
+
+constexpr const char *kRunning = "[RUNNING]";
+constexpr const char *kOk = "[OK]";
+constexpr const char *kFailed = "[FAILED]";
+constexpr const char *kReason = "Reason: ";
+
+template <typename T, size_t N>
+void AssertEqual(const SmallVector<T, N> &v, const std::vector<T> &expected,
+                 const std::string &line) {
+  if (v.Size() != expected.size())
+    throw TestError("Wrong size of v vector : " + std::string(__FILE__) +
+                    " : " + line);
+
+  for (size_t i(0); i < v.Size(); ++i) {
+    if (v[i] != expected[i])
+      throw TestError("Wrong element on position [" + std::to_string(i) +
+                      "] : " + std::string(__FILE__) + " : " + line);
+  }
+}
+
+} // namespace
+
+void Test() {
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test inline storage and spill";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      {
+        SmallVector<int, 4> v = {1, 2, 3, 4};
+        if (!v.IsInline() || v.Capacity() != 4)
+          throw TestError("Four elements left the inline buffer : " +
+                          std::to_string(__LINE__));
+        v.PushBack(5);
+        if (v.IsInline() || v.Capacity() != 8)
+          throw TestError("Fifth element did not spill : " +
+                          std::to_string(__LINE__));
+        AssertEqual(v, {1, 2, 3, 4, 5}, std::to_string(__LINE__));
+      }
+      {
+        SmallVector<int, 3> v(2, 7);
+        v.Resize(5, 1);
+        AssertEqual(v, {7, 7, 1, 1, 1}, std::to_string(__LINE__));
+        v.Resize(1);
+        AssertEqual(v, {7}, std::to_string(__LINE__));
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test small vector copy and move";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      {
+        SmallVector<std::string, 2> inline_v = {"a", "b"};
+        SmallVector<std::string, 2> heap_v = {"c", "d", "e"};
+        SmallVector<std::string, 2> copy(heap_v);
+        AssertEqual(copy, {"c", "d", "e"}, std::to_string(__LINE__));
+
+        SmallVector<std::string, 2> moved(std::move(inline_v));
+        AssertEqual(moved, {"a", "b"}, std::to_string(__LINE__));
+        AssertEqual(inline_v, {}, std::to_string(__LINE__));
+
+        const std::string *heap_data = heap_v.Data();
+        moved = std::move(heap_v);
+        if (moved.Data() != heap_data || !heap_v.IsInline())
+          throw TestError("Heap buffer was not stolen : " +
+                          std::to_string(__LINE__));
+        AssertEqual(moved, {"c", "d", "e"}, std::to_string(__LINE__));
+
+        moved = copy;
+        moved.PushBack(moved[0]);
+        AssertEqual(moved, {"c", "d", "e", "c"}, std::to_string(__LINE__));
+      }
+      {
+        SmallVector<std::unique_ptr<int>, 2> v;
+        for (int i(0); i < 10; ++i) {
+          v.EmplaceBack(new int(i));
+        }
+        SmallVector<std::unique_ptr<int>, 2> moved(std::move(v));
+        for (int i(0); i < 10; ++i) {
+          if (*moved[i] != i)
+            throw TestError("Wrong element on position [" +
+                            std::to_string(i) + "] : " +
+                            std::to_string(__LINE__));
+        }
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+}
+
+} // namespace small_vector_test
+
+#endif
+} // namespace tools::containers
@@ -2,54 +2,68 @@
 
 #include <cassert>
 #include <cctype>
+#include <cstring>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <strstream>
+#include <utility>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include "../memory/alloc_stats.hpp"
+
+#ifdef DEBUG
+#include "../memory/arena.hpp"
+#endif
 namespace {
 constexpr const size_t kMaxStringSize = 1'048'576;
+constexpr const size_t kStringInlineSize = 16;
 }
 namespace tools::containers {
 
-class String {
+// Growable byte string. Storage comes from Alloc (std::allocator by default),
+// which follows the buffer on moves and assignments, the same way Vector
+// handles it.
+//
+// Strings of up to kStringInlineSize - 1 bytes live in a buffer that shares
+// space with the heap capacity, so they never allocate and copying or moving
+// them is a couple of word copies. The contents are always followed by '\0'.
+template <typename Alloc = std::allocator<char>> class BasicString {
+  using Allocator =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<char>;
+  using AllocTraits = std::allocator_traits<Allocator>;
+
 public:
-  String() {
-    data_ = new char[4];
-    capacity_ = 4;
-    size_ = 0;
-  }
+  BasicString() : BasicString(Alloc()) {}
 
-  String(const String &string) {
-    data_ = new char[string.capacity_];
-    capacity_ = string.capacity_;
-    size_ = string.size_;
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = string.data_[i];
-    }
-  }
+  explicit BasicString(const Alloc &alloc) : alloc_(alloc) {}
 
-  explicit String(const char string[]) {
-    data_ = new char[strlen(string)];
-    capacity_ = strlen(string);
-    size_ = strlen(string);
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = string[i];
-    }
+  BasicString(const BasicString &string)
+      : alloc_(AllocTraits::select_on_container_copy_construction(
+            string.alloc_)) {
+    Append(string.data_, string.size_);
   }
 
-  String(String &&sr) noexcept {
-    this->data_ = sr.data_;
-    sr.data_ = nullptr;
-    this->size_ = sr.size_;
-    this->capacity_ = sr.capacity_;
+  explicit BasicString(const char string[], const Alloc &alloc = Alloc())
+      : alloc_(alloc) {
+    Append(string, strlen(string));
   }
 
+  BasicString(BasicString &&sr) noexcept : alloc_(sr.alloc_) { Steal(sr); }
+
   [[nodiscard]] size_t Size() const { return size_; }
 
-  ~String() {
-    delete[] data_;
-    data_ = nullptr;
+  [[nodiscard]] size_t Capacity() const {
+    return IsInline() ? kStringInlineSize - 1 : capacity_;
   }
 
+  [[nodiscard]] const char *CStr() const { return data_; }
+
+  ~BasicString() { Deallocate(); }
+
   char &operator[](size_t index) {
     if (index >= size_)
       throw std::runtime_error("Bad index");
@@ -63,10 +77,22 @@ public:
   }
 
   void Insert(char v) {
-    if (size_ + 1 > capacity_) {
-      Reallocate();
+    if (size_ + 1 > Capacity()) {
+      Reserve(Capacity() * 2);
     }
     data_[size_++] = v;
+    data_[size_] = '\0';
+  }
+
+  void Append(const char *data, size_t size) {
+    if (size_ + size > Capacity()) {
+      Reserve(size_ + size > Capacity() * 2 ? size_ + size : Capacity() * 2);
+    }
+    if (size != 0) {
+      memcpy(data_ + size_, data, size);
+    }
+    size_ += size;
+    data_[size_] = '\0';
   }
 
   void Erase(size_t i, size_t cnt) {
@@ -76,78 +102,177 @@ public:
       data_[i_v - cnt] = data_[i_v];
     }
     size_ -= cnt;
+    data_[size_] = '\0';
   }
 
-  String &operator=(const String &sr) {
+  BasicString &operator=(const BasicString &sr) {
     if (this == &sr)
       return *this;
-    delete[] data_;
-    this->data_ = new char[sr.capacity_];
-    this->capacity_ = sr.capacity_;
-    this->size_ = 0;
-    for (; this->size_ < sr.size_; ++this->size_) {
-      this->data_[this->size_] = sr.data_[this->size_];
-    }
+    BasicString copy(sr);
+    return *this = std::move(copy);
+  }
+
+  BasicString &operator=(BasicString &&sr) noexcept {
+    if (this == &sr)
+      return *this;
+    Deallocate();
+    alloc_ = sr.alloc_;
+    Steal(sr);
     return *this;
   }
 
-  String &operator=(String &&sr) noexcept {
-    delete[] data_;
-    data_ = sr.data_;
-    sr.data_ = nullptr;
-    capacity_ = sr.capacity_;
-    sr.capacity_ = 0;
+  [[nodiscard]] Allocator GetAllocator() const { return alloc_; }
+
+  template <typename A>
+  friend std::istream &operator>>(std::istream &is, BasicString<A> &s);
+
+private:
+  [[nodiscard]] bool IsInline() const { return data_ == inline_; }
+
+  // Takes sr's contents, leaving it empty and inline. Expects this string to
+  // hold no heap buffer.
+  void Steal(BasicString &sr) noexcept {
     size_ = sr.size_;
+    if (sr.IsInline()) {
+      memcpy(inline_, sr.inline_, kStringInlineSize);
+      data_ = inline_;
+    } else {
+      data_ = sr.data_;
+      capacity_ = sr.capacity_;
+    }
+    sr.data_ = sr.inline_;
+    sr.inline_[0] = '\0';
     sr.size_ = 0;
-    return *this;
   }
 
-  friend std::istream &operator>>(std::istream &is, String &s);
+  void Clear() {
+    size_ = 0;
+    data_[0] = '\0';
+  }
 
-private:
-  char *data_ = nullptr;
-  size_t size_;
-  size_t capacity_;
-
-  void Reallocate() {
-    capacity_ *= 2;
-    char *n_data = new char[capacity_];
-    for (size_t i(0); i < size_; ++i) {
-      n_data[i] = data_[i];
+  void Reserve(size_t capacity) {
+    if (capacity <= Capacity())
+      return;
+    char *n_data = AllocTraits::allocate(alloc_, capacity + 1);
+    memory::RecordAllocation(memory::AllocSite::kString, capacity + 1);
+    memcpy(n_data, data_, size_ + 1);
+    if (!IsInline()) {
+      memory::RecordReallocation(memory::AllocSite::kString);
     }
-    delete[] data_;
+    Deallocate();
     data_ = n_data;
+    capacity_ = capacity;
+  }
+
+  void Deallocate() noexcept {
+    if (!IsInline()) {
+      memory::RecordDeallocation(memory::AllocSite::kString, capacity_ + 1);
+      AllocTraits::deallocate(alloc_, data_, capacity_ + 1);
+      data_ = inline_;
+    }
   }
+
+  char *data_ = inline_;
+  size_t size_ = 0;
+  union {
+    size_t capacity_;
+    char inline_[kStringInlineSize] = {};
+  };
+  [[no_unique_address]] Allocator alloc_;
 };
 
-std::ostream &operator<<(std::ostream &os, const String &s) {
+using String = BasicString<>;
+
+template <typename Alloc>
+std::ostream &operator<<(std::ostream &os, const BasicString<Alloc> &s) {
   for (size_t i(0); i < s.Size(); ++i) {
     os << s[i];
   }
   return os;
 }
 
+// Returns the first character in [begin, end) that isspace() accepts in the
+// "C" locale, i.e. ' ' or '\t'..'\r', or end if there is none.
+inline const char *FindSpace(const char *begin, const char *end) {
+#ifdef __x86_64__
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i range = _mm_set1_epi8('\r' - '\t');
+  for (; end - begin >= 16; begin += 16) {
+    const __m128i x =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+    const __m128i shifted = _mm_sub_epi8(x, tab);
+    const __m128i in_range =
+        _mm_cmpeq_epi8(_mm_min_epu8(shifted, range), shifted);
+    const int mask =
+        _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, space), in_range));
+    if (mask != 0) {
+      return begin + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; begin != end; ++begin) {
+    const auto c = static_cast<unsigned char>(*begin);
+    if (c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t') {
+      return begin;
+    }
+  }
+  return end;
+}
 
+// Exposes the get area of any std::streambuf. Pointers to the protected
+// members are formed through a derived class, which is allowed, and then
+// applied to the base object.
+struct StreamBufAccess : std::streambuf {
+  static const char *Begin(std::streambuf *sb) {
+    return (sb->*&StreamBufAccess::gptr)();
+  }
+  static const char *End(std::streambuf *sb) {
+    return (sb->*&StreamBufAccess::egptr)();
+  }
+  static void Bump(std::streambuf *sb, size_t n) {
+    (sb->*&StreamBufAccess::gbump)(static_cast<int>(n));
+  }
+};
 
-std::istream &operator>>(std::istream &is, String &s) {
-  delete[] s.data_;
-  s.capacity_ = 4;
-  s.size_ = 0;
-  s.data_ = new char[s.capacity_];
+// Copies whole runs of non-space bytes straight out of the stream buffer's get
+// area instead of going through sgetc/sbumpc for every character. Buffers
+// that keep no get area fall back to one character per underflow.
+template <typename Alloc>
+std::istream &operator>>(std::istream &is, BasicString<Alloc> &s) {
+  s.Clear();
   is.setstate(std::istream::goodbit);
   std::basic_istream<char>::sentry sentry(is);
   if (sentry) {
+    std::streambuf *sb = is.rdbuf();
     while (s.size_ < kMaxStringSize) {
-      int c = is.rdbuf()->sgetc();
-      if (c == EOF) {
-        is.setstate(std::istream::eofbit);
-        break;
+      const char *begin = StreamBufAccess::Begin(sb);
+      const char *end = StreamBufAccess::End(sb);
+      if (begin == end) {
+        const int c = sb->sgetc();
+        if (c == EOF) {
+          is.setstate(std::istream::eofbit);
+          break;
+        }
+        if (StreamBufAccess::Begin(sb) != StreamBufAccess::End(sb)) {
+          continue;
+        }
+        if (isspace(c)) {
+          break;
+        }
+        s.Insert(static_cast<char>(c));
+        sb->sbumpc();
+        continue;
       }
-      if (isspace(c)) {
+      if (static_cast<size_t>(end - begin) > kMaxStringSize - s.size_) {
+        end = begin + (kMaxStringSize - s.size_);
+      }
+      const char *stop = FindSpace(begin, end);
+      s.Append(begin, stop - begin);
+      StreamBufAccess::Bump(sb, stop - begin);
+      if (stop != end) {
         break;
       }
-      s.Insert(static_cast<char>(c));
-      is.rdbuf()->sbumpc();
     }
     if (s.size_ == 0) {
       is.setstate(std::istream::failbit);
@@ -156,7 +281,8 @@ std::istream &operator>>(std::istream &is, String &s) {
   return is;
 }
 
-bool operator==(const String &sl, const String &sr) {
+template <typename Alloc>
+bool operator==(const BasicString<Alloc> &sl, const BasicString<Alloc> &sr) {
   if (sl.Size() != sr.Size())
     return false;
   for (size_t i(0); i < sl.Size(); ++i) {
@@ -171,7 +297,8 @@ bool operator==(const String &sl, const String &sr) {
 namespace string_test {
 namespace {
 
-void AssertEq(const String &str, const std::string &expected) {
+template <typename Alloc>
+void AssertEq(const BasicString<Alloc> &str, const std::string &expected) {
   assert(str.Size() == expected.size());
   for (int i(0); i < expected.size(); ++i) {
     assert(str[i] == expected[i]);
@@ -209,6 +336,83 @@ void Test() {
   s1.Erase(1, 2);
   std::string expected_result_5 = "a";
   AssertEq(s1, expected_result_5);
+
+  {
+    std::string long_token(100, 'x');
+    long_token[37] = '\x80';
+    std::istringstream is(" \t\nab\vcd\f\r" + long_token + "  tail");
+    String s;
+    is >> s;
+    AssertEq(s, "ab");
+    is >> s;
+    AssertEq(s, "cd");
+    is >> s;
+    AssertEq(s, long_token);
+    is >> s;
+    AssertEq(s, "tail");
+    assert(is.eof() && !is.fail());
+    assert(!(is >> s));
+  }
+  {
+    // Get area of three bytes, so tokens straddle refills.
+    struct ChunkedBuf : std::streambuf {
+      explicit ChunkedBuf(std::string data) : data_(std::move(data)) {}
+      int_type underflow() override {
+        if (pos_ == data_.size())
+          return traits_type::eof();
+        const size_t n = std::min<size_t>(3, data_.size() - pos_);
+        setg(&data_[pos_], &data_[pos_], &data_[pos_] + n);
+        pos_ += n;
+        return traits_type::to_int_type(*gptr());
+      }
+      std::string data_;
+      size_t pos_ = 0;
+    } buf("first  second_token\nz");
+    std::istream is(&buf);
+    String s;
+    is >> s;
+    AssertEq(s, "first");
+    is >> s;
+    AssertEq(s, "second_token");
+    is >> s;
+    AssertEq(s, "z");
+    assert(!(is >> s));
+  }
+  {
+    String moved("abc");
+    String to(std::move(moved));
+    moved.Insert('q');
+    AssertEq(moved, "q");
+  }
+  {
+    tools::memory::Arena arena;
+    using ArenaString = BasicString<tools::memory::ArenaAllocator<char>>;
+    ArenaString s{tools::memory::ArenaAllocator<char>(arena)};
+    std::istringstream is("arena_backed_token");
+    is >> s;
+    ArenaString copy(s);
+    AssertEq(copy, "arena_backed_token");
+    assert(copy.GetAllocator().GetArena() == &arena);
+  }
+  {
+    tools::memory::Arena arena;
+    using ArenaString = BasicString<tools::memory::ArenaAllocator<char>>;
+    ArenaString inline_s("fifteen chars..",
+                         tools::memory::ArenaAllocator<char>(arena));
+    ArenaString moved(std::move(inline_s));
+    ArenaString copy(moved);
+    assert(arena.Reserved() == 0);
+    assert(strcmp(copy.CStr(), "fifteen chars..") == 0);
+    assert(inline_s.Size() == 0 && inline_s.CStr()[0] == '\0');
+    copy.Insert('!');
+    assert(arena.Reserved() != 0);
+    AssertEq(copy, "fifteen chars..!");
+    copy.Erase(0, 8);
+    assert(strcmp(copy.CStr(), "chars..!") == 0);
+    moved = std::move(copy);
+    AssertEq(moved, "chars..!");
+    assert(copy.Size() == 0);
+  }
 }
 
 } // namespace string_test
@@ -0,0 +1,416 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "../memory/alloc_stats.hpp"
+#include "vector.hpp"
+
+namespace {
+constexpr const size_t kStringPoolPageSize = 1 << 16;
+constexpr const size_t kStringPoolInitSlots = 64;
+constexpr const size_t kStringPoolMaxPagedEntry = 256;
+} // namespace
+
+namespace tools::containers {
+
+// Handle to a string owned by a StringPool. Two handles from the same pool
+// are equal exactly when they point at the same bytes, so == is a pointer
+// compare; ordering falls back to the contents and matches std::string's.
+class PooledString {
+public:
+  PooledString() = default;
+
+  [[nodiscard]] const char *Data() const noexcept {
+    return data_ ? data_ : "";
+  }
+  [[nodiscard]] size_t Size() const noexcept {
+    return data_ ? Header(data_)->size : 0;
+  }
+  [[nodiscard]] std::string_view View() const noexcept {
+    return {Data(), Size()};
+  }
+  [[nodiscard]] bool IsNull() const noexcept { return data_ == nullptr; }
+
+  friend bool operator==(PooledString l, PooledString r) {
+    return l.data_ == r.data_;
+  }
+  friend bool operator!=(PooledString l, PooledString r) {
+    return l.data_ != r.data_;
+  }
+  friend bool operator<(PooledString l, PooledString r) {
+    return l.data_ != r.data_ && l.View() < r.View();
+  }
+  friend bool operator>(PooledString l, PooledString r) { return r < l; }
+  friend bool operator<=(PooledString l, PooledString r) { return !(r < l); }
+  friend bool operator>=(PooledString l, PooledString r) { return !(l < r); }
+
+  // Mixed comparisons let a tree keyed by PooledString be searched with a
+  // plain string_view (e.g. through std::less<>) before or without interning.
+  friend bool operator==(PooledString l, std::string_view r) {
+    return l.View() == r;
+  }
+  friend bool operator<(PooledString l, std::string_view r) {
+    return l.View() < r;
+  }
+  friend bool operator<(std::string_view l, PooledString r) {
+    return l < r.View();
+  }
+
+private:
+  friend class StringPool;
+
+  struct EntryHeader {
+    uint32_t size;
+    uint32_t hash;
+    uint32_t refs;
+  };
+
+  explicit PooledString(const char *data) : data_(data) {}
+
+  static const EntryHeader *Header(const char *data) {
+    return reinterpret_cast<const EntryHeader *>(data) - 1;
+  }
+
+  const char *data_ = nullptr;
+};
+
+inline std::ostream &operator<<(std::ostream &os, PooledString s) {
+  return os << s.View();
+}
+
+// Deduplicating, reference-counted string storage. Every distinct string is
+// copied once, behind a small header with its size, hash and reference count,
+// and is found again through an open-addressing table. Short strings are
+// packed into pages and their space is reused through per-size free lists;
+// long ones get an allocation of their own. A handle stays valid until every
+// Intern that returned it has been matched by a Drop, or the pool is cleared.
+class StringPool {
+public:
+  StringPool() = default;
+  StringPool(const StringPool &) = delete;
+  StringPool &operator=(const StringPool &) = delete;
+
+  ~StringPool() { ReleaseMemory(); }
+
+  // Returns the handle for str, copying it into the pool on first sight, and
+  // takes one reference to it.
+  PooledString Intern(std::string_view str) {
+    if (str.size() > UINT32_MAX) {
+      throw std::length_error("String is too long for the pool");
+    }
+    const uint32_t hash = Hash(str);
+    if ((count_ + 1) * 4 > slots_.Size() * 3) {
+      Rehash(slots_.Size() == 0 ? kStringPoolInitSlots : slots_.Size() * 2);
+    }
+    size_t slot = Probe(str, hash);
+    if (slots_[slot] == nullptr) {
+      slots_[slot] = Store(str, hash);
+      ++count_;
+    } else {
+      EntryHeader *header = MutableHeader(slots_[slot]);
+      // A saturated count pins the string until Clear.
+      if (header->refs != UINT32_MAX) {
+        ++header->refs;
+      }
+    }
+    return PooledString(slots_[slot]);
+  }
+
+  // Gives back one reference taken by Intern. The string is freed with the
+  // last one and its handles become invalid.
+  void Drop(PooledString str) {
+    if (str.IsNull()) {
+      return;
+    }
+    EntryHeader *header = MutableHeader(str.data_);
+    if (header->refs == UINT32_MAX || --header->refs != 0) {
+      return;
+    }
+    Erase(SlotOf(str.data_));
+    --count_;
+    Free(str.data_);
+  }
+
+  // Returns the handle for str if it was interned before, an empty handle
+  // otherwise. Never allocates.
+  [[nodiscard]] PooledString Find(std::string_view str) const {
+    if (count_ == 0) {
+      return {};
+    }
+    return PooledString(slots_[Probe(str, Hash(str))]);
+  }
+
+  // Number of distinct strings held.
+  [[nodiscard]] size_t Size() const noexcept { return count_; }
+
+  // Drops every string at once; all handles handed out become invalid.
+  void Clear() {
+    ReleaseMemory();
+    pages_ = Vector<std::unique_ptr<char[]>>();
+    slots_ = Vector<const char *>();
+    std::fill(std::begin(free_), std::end(free_), nullptr);
+    current_ = end_ = nullptr;
+    count_ = 0;
+  }
+
+private:
+  using EntryHeader = PooledString::EntryHeader;
+
+  // A free entry keeps the link to the next one of its size where its header
+  // was.
+  static_assert(sizeof(EntryHeader) >= sizeof(char *));
+
+  static EntryHeader *MutableHeader(const char *data) {
+    return const_cast<EntryHeader *>(PooledString::Header(data));
+  }
+
+  // Multiplicative hash over 8-byte words; the tail is read as a partial
+  // word so short keys cost one or two multiplications.
+  static uint32_t Hash(std::string_view str) {
+    constexpr uint64_t kMul = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = str.size() * kMul;
+    size_t i(0);
+    for (; i + 8 <= str.size(); i += 8) {
+      uint64_t word;
+      memcpy(&word, str.data() + i, 8);
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 29;
+    }
+    if (i < str.size()) {
+      uint64_t word = 0;
+      memcpy(&word, str.data() + i, str.size() - i);
+      hash = (hash ^ word) * kMul;
+      hash ^= hash >> 29;
+    }
+    return static_cast<uint32_t>(hash ^ (hash >> 32));
+  }
+
+  // Slot holding str, or the empty slot where it would go.
+  [[nodiscard]] size_t Probe(std::string_view str, uint32_t hash) const {
+    const size_t mask = slots_.Size() - 1;
+    for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+      const char *data = slots_[slot];
+      if (data == nullptr) {
+        return slot;
+      }
+      const EntryHeader *header = PooledString::Header(data);
+      if (header->hash == hash && header->size == str.size() &&
+          (str.empty() || memcmp(data, str.data(), str.size()) == 0)) {
+        return slot;
+      }
+    }
+  }
+
+  // Slot holding exactly the entry at data, which must be in the table.
+  [[nodiscard]] size_t SlotOf(const char *data) const {
+    const size_t mask = slots_.Size() - 1;
+    size_t slot = PooledString::Header(data)->hash & mask;
+    while (slots_[slot] != data) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  }
+
+  // Empties slot without tombstones: later entries of the probe run are
+  // shifted back into the hole unless that would move them before their home
+  // slot.
+  void Erase(size_t slot) {
+    const size_t mask = slots_.Size() - 1;
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & mask; slots_[next] != nullptr;
+         next = (next + 1) & mask) {
+      const size_t home = PooledString::Header(slots_[next])->hash & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        slots_[hole] = slots_[next];
+        hole = next;
+      }
+    }
+    slots_[hole] = nullptr;
+  }
+
+  void Rehash(size_t slots) {
+    Vector<const char *> old(std::move(slots_));
+    slots_ = Vector<const char *>(slots, nullptr);
+    const size_t mask = slots - 1;
+    for (size_t i(0); i < old.Size(); ++i) {
+      if (old[i] == nullptr) {
+        continue;
+      }
+      size_t slot = PooledString::Header(old[i])->hash & mask;
+      while (slots_[slot] != nullptr) {
+        slot = (slot + 1) & mask;
+      }
+      slots_[slot] = old[i];
+    }
+  }
+
+  // Space an entry for a string of size bytes takes.
+  static size_t EntryBytes(size_t size) {
+    constexpr size_t kAlign = alignof(EntryHeader);
+    return (sizeof(EntryHeader) + size + 1 + kAlign - 1) & ~(kAlign - 1);
+  }
+
+  static char *EntryOf(const char *data) {
+    return reinterpret_cast<char *>(MutableHeader(data));
+  }
+
+  // Pages go back with the pool; long entries are found through the table.
+  void ReleaseMemory() noexcept {
+    for (size_t i(0); i < slots_.Size(); ++i) {
+      if (slots_[i] != nullptr &&
+          EntryBytes(PooledString::Header(slots_[i])->size) >
+              kStringPoolMaxPagedEntry) {
+        Free(slots_[i]);
+      }
+    }
+    for (size_t i(0); i < pages_.Size(); ++i) {
+      memory::RecordDeallocation(memory::AllocSite::kStringPool,
+                                 kStringPoolPageSize);
+    }
+  }
+
+  // Space for an entry of the given size: a freed one of the same size, the
+  // tail of the current page or a new page. Long entries are allocated alone.
+  char *Allocate(size_t bytes) {
+    if (bytes > kStringPoolMaxPagedEntry) {
+      memory::RecordAllocation(memory::AllocSite::kStringPool, bytes);
+      return new char[bytes];
+    }
+    char *&head = free_[bytes / alignof(EntryHeader)];
+    if (head != nullptr) {
+      char *entry = head;
+      memcpy(&head, entry, sizeof(char *));
+      return entry;
+    }
+    if (current_ == nullptr || static_cast<size_t>(end_ - current_) < bytes) {
+      pages_.EmplaceBack(new char[kStringPoolPageSize]);
+      memory::RecordAllocation(memory::AllocSite::kStringPool,
+                               kStringPoolPageSize);
+      current_ = pages_[pages_.Size() - 1].get();
+      end_ = current_ + kStringPoolPageSize;
+    }
+    char *entry = current_;
+    current_ += bytes;
+    return entry;
+  }
+
+  void Free(const char *data) noexcept {
+    const size_t bytes = EntryBytes(PooledString::Header(data)->size);
+    char *entry = EntryOf(data);
+    if (bytes > kStringPoolMaxPagedEntry) {
+      memory::RecordDeallocation(memory::AllocSite::kStringPool, bytes);
+      delete[] entry;
+      return;
+    }
+    char *&head = free_[bytes / alignof(EntryHeader)];
+    memcpy(entry, &head, sizeof(char *));
+    head = entry;
+  }
+
+  // Copies str behind its header, terminated by '\0' so Data() can be handed
+  // to C APIs.
+  const char *Store(std::string_view str, uint32_t hash) {
+    char *entry = Allocate(EntryBytes(str.size()));
+    auto *header = reinterpret_cast<EntryHeader *>(entry);
+    header->size = static_cast<uint32_t>(str.size());
+    header->hash = hash;
+    header->refs = 1;
+    char *data = entry + sizeof(EntryHeader);
+    if (!str.empty()) {
+      memcpy(data, str.data(), str.size());
+    }
+    data[str.size()] = '\0';
+    return data;
+  }
+
+  Vector<std::unique_ptr<char[]>> pages_;
+  Vector<const char *> slots_;
+  // Heads of the free lists of paged entries, indexed by size / alignment.
+  char *free_[kStringPoolMaxPagedEntry / alignof(EntryHeader) + 1] = {};
+  char *current_ = nullptr;
+  char *end_ = nullptr;
+  size_t count_ = 0;
+};
+
+#ifdef DEBUG
+
+namespace string_pool_test {
+
+void Test() {
+  StringPool pool;
+  assert(pool.Find("absent").IsNull());
+
+  const PooledString a = pool.Intern("apple");
+  const PooledString b = pool.Intern(std::string("app") + "le");
+  [[maybe_unused]] const PooledString c = pool.Intern("banana");
+  assert(a == b && a.Data() == b.Data());
+  assert(a != c && a < c && c > a && a <= b && a >= b);
+  assert(a.View() == "apple" && a.Size() == 5 && a.Data()[5] == '\0');
+  assert(pool.Find("banana") == c && pool.Find("cherry").IsNull());
+
+  [[maybe_unused]] const PooledString empty = pool.Intern("");
+  assert(!empty.IsNull() && empty.Size() == 0 && empty < a);
+
+  const std::string long_str(kStringPoolPageSize * 2, 'x');
+  const PooledString l = pool.Intern(long_str);
+  assert(l.View() == long_str);
+
+  // Handles survive page and table growth.
+  for (int i(0); i < 100000; ++i) {
+    pool.Intern(std::to_string(i));
+  }
+  assert(pool.Size() == 100004);
+  assert(pool.Intern("apple") == a && a.View() == "apple");
+  for (int i(0); i < 100000; ++i) {
+    assert(pool.Find(std::to_string(i)).View() == std::to_string(i));
+  }
+
+  // "apple" was interned three times and goes with the third Drop.
+  pool.Drop(a);
+  pool.Drop(b);
+  assert(pool.Find("apple") == a);
+  pool.Drop(a);
+  assert(pool.Find("apple").IsNull() && pool.Find("banana") == c);
+  pool.Drop(l);
+  assert(pool.Find(long_str).IsNull());
+
+  // Dropping shifts probe runs back, so what is left is still found.
+  for (int i(0); i < 100000; i += 2) {
+    pool.Drop(pool.Find(std::to_string(i)));
+  }
+  assert(pool.Size() == 50002);
+  for (int i(0); i < 100000; ++i) {
+    assert(pool.Find(std::to_string(i)).IsNull() == (i % 2 == 0));
+  }
+
+  // Churn through distinct words: a dropped entry is reused by the next word
+  // of its size, so the pool does not grow.
+  const PooledString first = pool.Intern("churn0000000");
+  [[maybe_unused]] const char *reused = first.Data();
+  pool.Drop(first);
+  for (int i(1); i < 1000000; ++i) {
+    std::string word = std::to_string(i);
+    word = "churn" + std::string(7 - word.size(), '0') + word;
+    const PooledString s = pool.Intern(word);
+    assert(s.Data() == reused && s.View() == word);
+    pool.Drop(s);
+  }
+  assert(pool.Size() == 50002);
+
+  pool.Clear();
+  assert(pool.Size() == 0 && pool.Find("apple").IsNull());
+}
+
+} // namespace string_pool_test
+
+#endif
+
+} // namespace tools::containers
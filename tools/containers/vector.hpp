@@ -1,151 +1,246 @@
 #pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <exception>
 #include <initializer_list>
 #include <iterator>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "../memory/alloc_stats.hpp"
+
+#ifdef DEBUG
+#include "../memory/arena.hpp"
+#endif
+
 namespace {
 constexpr const size_t kArrayResizeK = 2;
+constexpr const size_t kArrayInitCapacity = 4;
 }
 
 namespace tools::containers {
 
-template <typename T> class Vector {
-public:
-  Vector() {
-    size_ = 0;
-    capacity_ = 4;
-    data_ = new T[capacity_];
+// Tells Vector that a T can be moved to another address by copying its bytes
+// and forgetting the original, without calling its move constructor and
+// destructor. Holds for trivially copyable types; specialize it to true for
+// other types that keep no pointers into themselves.
+template <typename T>
+struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+template <typename T, typename D>
+struct IsTriviallyRelocatable<std::unique_ptr<T, D>>
+    : IsTriviallyRelocatable<D> {};
+
+template <typename T>
+struct IsTriviallyRelocatable<std::shared_ptr<T>> : std::true_type {};
+
+// Bounds checking policies for Vector::operator[]. At() always checks.
+struct CheckedAccess {
+  static void Check(size_t n, size_t size) {
+    if (n >= size) {
+      throw std::range_error("");
+    }
+  }
+};
+
+// Checks only in DEBUG builds, so release hot loops index unchecked and the
+// compiler is free to vectorize them.
+struct DebugCheckedAccess {
+  static void Check([[maybe_unused]] size_t n, [[maybe_unused]] size_t size) {
+#ifdef DEBUG
+    CheckedAccess::Check(n, size);
+#endif
   }
+};
 
-  explicit Vector(size_t size) {
-    size_ = size;
+struct UncheckedAccess {
+  static void Check(size_t, size_t) noexcept {}
+};
 
-    capacity_ = [&size]() {
-      size_t res = 2;
-      while (res < size) {
-        res *= 2;
-      }
-      return res;
-    }();
+// Growth policies: Next gives the capacity after a full buffer, Fit the
+// capacity Reserve and the sizing constructors round a request up to.
+// GeometricGrowth multiplies the capacity by Num / Den.
+template <size_t Num, size_t Den = 1> struct GeometricGrowth {
+  static_assert(Num > Den, "Growth factor must be above 1");
+
+  static size_t Next(size_t capacity) {
+    if (capacity == 0) {
+      return kArrayInitCapacity;
+    }
+    const size_t step = capacity * (Num - Den) / Den;
+    return capacity + (step == 0 ? 1 : step);
+  }
 
-    data_ = new T[capacity_];
+  static size_t Fit(size_t capacity) {
+    size_t res = 2;
+    while (res < capacity) {
+      res = Next(res);
+    }
+    return res;
   }
+};
 
-  Vector(size_t size, const T &default_value) {
-    size_ = size;
+// Geometric until the buffer holds Step elements, then Step more at a time,
+// so a huge array wastes at most Step slots instead of a constant fraction
+// of itself. Together with the realloc path the extra steps are cheap.
+template <size_t Step, size_t Num = kArrayResizeK, size_t Den = 1>
+struct SteppedGrowth {
+  static_assert(Step > 0, "Step must be positive");
 
-    capacity_ = [&size]() {
-      size_t res = 2;
-      while (res < size) {
-        res *= 2;
-      }
-      return res;
-    }();
+  static size_t Next(size_t capacity) {
+    return capacity < Step ? GeometricGrowth<Num, Den>::Next(capacity)
+                           : capacity + Step;
+  }
 
-    data_ = new T[capacity_];
+  static size_t Fit(size_t capacity) {
+    return capacity <= Step ? GeometricGrowth<Num, Den>::Fit(capacity)
+                            : (capacity + Step - 1) / Step * Step;
+  }
+};
+
+// Storage comes from Alloc (std::allocator by default, rebound to T). The
+// allocator always travels with the buffer: copies take the source's
+// allocator as select_on_container_copy_construction gives it, and moves and
+// assignments adopt the allocator together with the elements.
+//
+// Bounds picks how operator[] validates its index and Growth how the
+// capacity grows; both are stateless policy types from above.
+template <typename T, typename Alloc = std::allocator<T>,
+          typename Bounds = CheckedAccess,
+          typename Growth = GeometricGrowth<kArrayResizeK>>
+class Vector {
+  using Allocator =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  using AllocTraits = std::allocator_traits<Allocator>;
+
+  static constexpr bool kRelocateBytes = IsTriviallyRelocatable<T>::value;
+  // Such elements in default-allocated storage grow through realloc, which
+  // for large buffers remaps pages instead of copying them and never holds
+  // the old and the new buffer at once.
+  static constexpr bool kUseRealloc =
+      kRelocateBytes && std::is_same_v<Allocator, std::allocator<T>> &&
+      alignof(T) <= alignof(std::max_align_t);
+
+public:
+  Vector() = default;
 
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = default_value;
+  explicit Vector(const Alloc &alloc) noexcept : alloc_(alloc) {}
+
+  explicit Vector(size_t size, const Alloc &alloc = Alloc()) : alloc_(alloc) {
+    Reallocate(RoundCapacity(size));
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T();
     }
   }
 
-  Vector(std::initializer_list<const T> list) {
-    size_ = list.size();
+  Vector(size_t size, const T &default_value, const Alloc &alloc = Alloc())
+      : alloc_(alloc) {
+    Reallocate(RoundCapacity(size));
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T(default_value);
+    }
+  }
 
-    capacity_ = [&list]() {
-      size_t res = 2;
-      while (res < list.size()) {
-        res *= 2;
-      }
-      return res;
-    }();
+  Vector(std::initializer_list<T> list, const Alloc &alloc = Alloc())
+      : alloc_(alloc) {
+    Reallocate(RoundCapacity(list.size()));
+    for (const T &el : list) {
+      new (data_ + size_) T(el);
+      ++size_;
+    }
+  }
 
-    data_ = new T[capacity_];
-    size_t j(0);
-    for (auto el = list.begin(); el != list.end(); ++el) {
-      data_[j++] = std::move(*el);
+  Vector(const Vector &v)
+      : alloc_(AllocTraits::select_on_container_copy_construction(v.alloc_)) {
+    Reallocate(v.capacity_);
+    for (; size_ < v.size_; ++size_) {
+      new (data_ + size_) T(v.data_[size_]);
     }
   }
 
-  Vector(Vector &&v) {
-    capacity_ = v.capacity;
-    size_ = v.Size();
-    delete[] data_;
-    data_ = v.data_;
+  Vector(Vector &&v) noexcept
+      : data_(v.data_), size_(v.size_), capacity_(v.capacity_),
+        alloc_(v.alloc_) {
     v.data_ = nullptr;
     v.capacity_ = 0;
     v.size_ = 0;
   }
 
-  void PushBack(const T &elem) {
-    if (size_ + 1 > capacity_) {
-      Reallocate();
+  void PushBack(const T &elem) { EmplaceBack(elem); }
+
+  void PushBack(T &&elem) { EmplaceBack(std::move(elem)); }
+
+  // On growth the new element is built before the old ones are relocated,
+  // so arguments referring into this vector stay valid.
+  template <typename... Args> T &EmplaceBack(Args &&...args) {
+    if (size_ < capacity_) {
+      new (data_ + size_) T(std::forward<Args>(args)...);
+      return data_[size_++];
+    }
+    const size_t capacity = NextCapacity();
+    if constexpr (kUseRealloc) {
+      T value(std::forward<Args>(args)...);
+      Reallocate(capacity);
+      new (data_ + size_) T(std::move(value));
+      return data_[size_++];
+    }
+    T *new_data = Allocate(capacity);
+    try {
+      new (new_data + size_) T(std::forward<Args>(args)...);
+    } catch (...) {
+      Deallocate(new_data, capacity);
+      throw;
+    }
+    try {
+      Relocate(new_data, capacity);
+    } catch (...) {
+      new_data[size_].~T();
+      Deallocate(new_data, capacity);
+      throw;
     }
-    data_[size_++] = elem;
+    return data_[size_++];
   }
 
   void Reserve(size_t capacity) {
-
-    capacity_ = [&capacity]() {
-      size_t res = 2;
-      while (res < capacity) {
-        res *= 2;
-      }
-      return res;
-    }();
-
-    Reallocate();
+    if (capacity > capacity_) {
+      Reallocate(RoundCapacity(capacity));
+    }
   }
 
   void Resize(size_t size) {
-    size_ = size;
-
-    capacity_ = [&size]() {
-      size_t res = 2;
-      while (res < size) {
-        res *= 2;
-      }
-      return res;
-    }();
-
-    Reallocate();
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T();
+    }
+    Shrink(size);
   }
 
   void Resize(size_t size, const T &default_value) {
-    capacity_ = [&size]() {
-      size_t res = 2;
-      while (res < size) {
-        res *= 2;
-      }
-      return res;
-    }();
-
-    Reallocate();
-
-    for (size_t i(size_); i < size; ++i) {
-      data_[i] = default_value;
+    Reserve(size);
+    for (; size_ < size; ++size_) {
+      new (data_ + size_) T(default_value);
     }
-    size_ = size;
+    Shrink(size);
   }
 
   ~Vector() {
-    delete[] data_;
+    Shrink(0);
+    Deallocate(data_, capacity_);
     data_ = nullptr;
   }
 
   T &operator[](size_t n) {
-    if (n >= size_) {
-      throw std::range_error("");
-    }
+    Bounds::Check(n, size_);
     return data_[n];
   }
 
   const T &operator[](size_t n) const {
-    if (n >= size_) {
-      throw std::range_error("");
-    }
+    Bounds::Check(n, size_);
     return data_[n];
   }
 
@@ -164,20 +259,20 @@ public:
   }
 
   Vector &operator=(const Vector &x) {
-    if (this == *x)
+    if (this == &x)
       return *this;
 
-    Reserve(x.capacity_);
-    size_ = x.size_;
-    for (size_t i(0); i < size_; ++i) {
-      data_[i] = x.data_[i];
-    }
-
-    return *this;
+    Vector copy(x);
+    return *this = std::move(copy);
   }
 
   Vector &operator=(Vector &&x) noexcept {
-    delete[] data_;
+    if (this == &x)
+      return *this;
+
+    Shrink(0);
+    Deallocate(data_, capacity_);
+    alloc_ = x.alloc_;
     data_ = x.data_;
     x.data_ = nullptr;
     capacity_ = x.capacity_;
@@ -188,32 +283,138 @@ public:
   }
 
   [[nodiscard]] size_t Size() const noexcept { return size_; }
-  [[nodiscard]] size_t Capacity() const noexcept { return capacity_; };
+  [[nodiscard]] size_t Capacity() const noexcept { return capacity_; }
+  T *Data() noexcept { return data_; }
+  const T *Data() const noexcept { return data_; }
+  [[nodiscard]] Allocator GetAllocator() const { return alloc_; }
 
 private:
-  void Reallocate() {
-    capacity_ *= kArrayResizeK;
-    auto new_data = new T[capacity_];
-    for (size_t i(0); i < size_; ++i) {
-      new_data[i] = std::move(data_[i]);
+  T *Allocate(size_t capacity) {
+    T *data;
+    if constexpr (kUseRealloc) {
+      data = Realloc(nullptr, capacity);
+    } else {
+      data = AllocTraits::allocate(alloc_, capacity);
     }
-    delete[] data_;
+    memory::RecordAllocation(memory::AllocSite::kVector, capacity * sizeof(T));
+    return data;
+  }
+
+  void Deallocate(T *data, size_t capacity) noexcept {
+    if (data == nullptr) {
+      return;
+    }
+    memory::RecordDeallocation(memory::AllocSite::kVector,
+                               capacity * sizeof(T));
+    if constexpr (kUseRealloc) {
+      std::free(data);
+    } else {
+      AllocTraits::deallocate(alloc_, data, capacity);
+    }
+  }
+
+  static T *Realloc(T *data, size_t capacity) {
+    if (capacity > SIZE_MAX / sizeof(T)) {
+      throw std::bad_alloc();
+    }
+    void *new_data =
+        std::realloc(static_cast<void *>(data), capacity * sizeof(T));
+    if (new_data == nullptr && capacity != 0) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(new_data);
+  }
+
+  static size_t RoundCapacity(size_t capacity) {
+    return Growth::Fit(capacity);
+  }
+
+  [[nodiscard]] size_t NextCapacity() const {
+    return Growth::Next(capacity_);
+  }
+
+  // Trivially relocatable elements are copied over as bytes. Others are moved
+  // when T's move can't throw (or T can't be copied) and copied otherwise, so
+  // a throwing relocation leaves the vector untouched.
+  void Relocate(T *new_data, size_t capacity) {
+    if constexpr (kRelocateBytes) {
+      if (size_ != 0) {
+        std::memcpy(static_cast<void *>(new_data), data_, size_ * sizeof(T));
+      }
+    } else {
+      size_t i(0);
+      try {
+        for (; i < size_; ++i) {
+          new (new_data + i) T(std::move_if_noexcept(data_[i]));
+        }
+      } catch (...) {
+        while (i > 0) {
+          new_data[--i].~T();
+        }
+        throw;
+      }
+      for (i = 0; i < size_; ++i) {
+        data_[i].~T();
+      }
+    }
+    if (data_ != nullptr) {
+      memory::RecordReallocation(memory::AllocSite::kVector);
+    }
+    Deallocate(data_, capacity_);
     data_ = new_data;
+    capacity_ = capacity;
+  }
+
+  void Reallocate(size_t capacity) {
+    if constexpr (kUseRealloc) {
+      T *new_data = Realloc(data_, capacity);
+      if (data_ != nullptr) {
+        memory::RecordReallocation(memory::AllocSite::kVector);
+        memory::RecordDeallocation(memory::AllocSite::kVector,
+                                   capacity_ * sizeof(T));
+      }
+      memory::RecordAllocation(memory::AllocSite::kVector,
+                               capacity * sizeof(T));
+      data_ = new_data;
+      capacity_ = capacity;
+    } else {
+      T *new_data = Allocate(capacity);
+      try {
+        Relocate(new_data, capacity);
+      } catch (...) {
+        Deallocate(new_data, capacity);
+        throw;
+      }
+    }
+  }
+
+  void Shrink(size_t size) noexcept {
+    while (size_ > size) {
+      data_[--size_].~T();
+    }
   }
 
   T *data_ = nullptr;
-  size_t size_;
-  size_t capacity_;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  [[no_unique_address]] Allocator alloc_;
 };
 
+// The buffer pointer is all a Vector holds, so it can be relocated whenever
+// its allocator can.
+template <typename T, typename Alloc, typename Bounds, typename Growth>
+struct IsTriviallyRelocatable<Vector<T, Alloc, Bounds, Growth>>
+    : std::is_trivially_copyable<typename std::allocator_traits<
+          Alloc>::template rebind_alloc<T>> {};
+
 template <typename Tf, typename Ts>
 std::ostream &operator<<(std::ostream &os, const std::pair<Tf, Ts> &p) {
   os << "{ " << p.first << ", " << p.second << " }";
   return os;
 }
 
-template <typename T>
-std::ostream &operator<<(std::ostream &os, const Vector<T> &v) {
+template <typename T, typename... Policies>
+std::ostream &operator<<(std::ostream &os, const Vector<T, Policies...> &v) {
   os << "{ ";
   for (size_t i(0); i < v.Size(); ++i) {
     os << v[i] << (i + 1 == v.Size() ? "" : ", ");
@@ -228,9 +429,9 @@ class TestError : public std::runtime_error {
   using std::runtime_error::runtime_error;
 };
 
-template <typename T>
-void AssertEqual(const Vector<T> &v, const std::vector<T> &expected,
-                 const std::string &line) {
+template <typename T, typename... Policies>
+void AssertEqual(const Vector<T, Policies...> &v,
+                 const std::vector<T> &expected, const std::string &line) {
 
   if (v.Size() != expected.size())
     throw TestError("Wrong size of v vector" + std::string(__FILE__) + " : " +
@@ -245,6 +446,19 @@ void AssertEqual(const Vector<T> &v, const std::vector<T> &expected,
 
 #include "string.hpp"
 
+namespace vector_test {
+struct Relocated {
+  static inline int moves = 0;
+  explicit Relocated(int v) : value(v) {}
+  Relocated(Relocated &&r) noexcept : value(r.value) { ++moves; }
+  ~Relocated() { value = -1; }
+  int value;
+};
+} // namespace vector_test
+
+template <>
+struct IsTriviallyRelocatable<vector_test::Relocated> : std::true_type {};
+
 namespace vector_test {
 
 namespace {
@@ -362,6 +576,170 @@ void Test() {
     if (is_success)
       std::cout << kOk << ' ' << kTestName << std::endl;
   } /////////////////////////////////////////////////////////////////
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test emplace and move-only types";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      {
+        Vector<std::unique_ptr<int>> v;
+        for (int i(0); i < 100; ++i) {
+          v.PushBack(std::make_unique<int>(i));
+        }
+        v.EmplaceBack(new int(100));
+        for (int i(0); i <= 100; ++i) {
+          if (*v[i] != i)
+            throw TestError("Wrong element on position [" +
+                            std::to_string(i) + "] : " +
+                            std::to_string(__LINE__));
+        }
+      }
+      {
+        static int constructed = 0;
+        struct Counted {
+          Counted() { ++constructed; }
+        };
+        Vector<Counted> v;
+        v.Reserve(1000);
+        v.Resize(3);
+        if (constructed != 3 || v.Size() != 3 || v.Capacity() < 1000)
+          throw TestError("Reserve constructed spare elements: " +
+                          std::to_string(__LINE__));
+      }
+      {
+        const std::vector<std::string> expected = {"a", "a", "b"};
+        Vector<std::string> v = {"a"};
+        v.PushBack(v[0]);
+        v.EmplaceBack(1, 'b');
+        AssertEqual(v, expected, std::to_string(__LINE__));
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test arena allocated vector";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      tools::memory::Arena arena;
+      using Alloc = tools::memory::ArenaAllocator<int>;
+      std::vector<int> expected;
+      Vector<int, Alloc> v{Alloc(arena)};
+      for (int i(0); i < 1000; ++i) {
+        v.PushBack(i);
+        expected.push_back(i);
+      }
+      Vector<int, Alloc> copy(v);
+      Vector<int, Alloc> moved(std::move(v));
+      AssertEqual(copy, expected, std::to_string(__LINE__));
+      AssertEqual(moved, expected, std::to_string(__LINE__));
+      if (copy.GetAllocator().GetArena() != &arena)
+        throw TestError("Copy left the arena : " + std::to_string(__LINE__));
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test trivially relocatable growth";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      {
+        Vector<Relocated> v;
+        for (int i(0); i < 1000; ++i) {
+          v.EmplaceBack(i);
+        }
+        const int moves = Relocated::moves;
+        v.Reserve(1 << 20);
+        for (int i(0); i < 1000; ++i) {
+          if (v[i].value != i)
+            throw TestError("Wrong element on position [" +
+                            std::to_string(i) + "] : " +
+                            std::to_string(__LINE__));
+        }
+        if (Relocated::moves != moves)
+          throw TestError("Reserve moved relocatable elements : " +
+                          std::to_string(__LINE__));
+      }
+      {
+        const std::vector<int> expected = {1, 2, 3, 1, 2, 3};
+        Vector<Vector<int>> v;
+        for (int i(0); i < 100; ++i) {
+          v.PushBack({1, 2, 3});
+        }
+        v[0].PushBack(1);
+        v[0].PushBack(2);
+        v[0].PushBack(v[0][2]);
+        AssertEqual(v[0], expected, std::to_string(__LINE__));
+        const Vector<int> copy(v[99]);
+        AssertEqual(copy, {1, 2, 3}, std::to_string(__LINE__));
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test vector policies";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      {
+        Vector<int, std::allocator<int>, CheckedAccess, GeometricGrowth<3, 2>>
+            v;
+        std::vector<size_t> capacities;
+        for (int i(0); i < 20; ++i) {
+          v.PushBack(i);
+          if (capacities.empty() || capacities.back() != v.Capacity())
+            capacities.push_back(v.Capacity());
+        }
+        if (capacities != std::vector<size_t>{4, 6, 9, 13, 19, 28})
+          throw TestError("Wrong 1.5x growth : " + std::to_string(__LINE__));
+        bool thrown = false;
+        try {
+          v[20];
+        } catch (const std::range_error &) {
+          thrown = true;
+        }
+        if (!thrown)
+          throw TestError("Checked access did not throw : " +
+                          std::to_string(__LINE__));
+      }
+      {
+        Vector<int, std::allocator<int>, UncheckedAccess, SteppedGrowth<64>> v;
+        for (int i(0); i < 1000; ++i) {
+          v.PushBack(i);
+        }
+        if (v.Capacity() != 1024 || v[999] != 999)
+          throw TestError("Wrong stepped growth : " +
+                          std::to_string(__LINE__));
+        v.Reserve(1100);
+        if (v.Capacity() != 1152)
+          throw TestError("Reserve ignored the step : " +
+                          std::to_string(__LINE__));
+        AssertEqual(Vector<int, std::allocator<int>, UncheckedAccess>{1, 2},
+                    {1, 2}, std::to_string(__LINE__));
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
 }
 
 } // namespace vector_test
@@ -1,51 +1,339 @@
 #pragma once
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 #include <algorithm>
-#include <functional>
+#include <concepts>
+#include <type_traits>
+#include <cstdint>
 #include <iostream>
+#include <stdexcept>
+#include <thread>
 
 #include "vector.hpp"
 
+namespace {
+constexpr const size_t kRadixDigitBits = 11;
+constexpr const size_t kRadixDigitSize = size_t(1) << kRadixDigitBits;
+constexpr const size_t kRadixDigitMask = kRadixDigitSize - 1;
+constexpr const size_t kCountingRangeFactor = 8;
+constexpr const size_t kParallelMinChunk = 1 << 16;
+constexpr const size_t kSubHistograms = 4;
+// The sub-histograms are kSubHistograms uint32_t lanes per bucket: 64 KiB at
+// this cap, where 2^16 buckets would take 1 MiB.
+constexpr const size_t kSubHistogramMaxBuckets = 1 << 12;
+} // namespace
+
 namespace tools::containers::vector_tools {
 
+// Key extractors are taken by reference and called on const elements, so
+// they inline into the histogram and scatter loops and never copy a record.
+template <typename Fn, typename T>
+concept KeyExtractor = std::invocable<const Fn &, const T &> &&
+    std::convertible_to<std::invoke_result_t<const Fn &, const T &>, size_t>;
+
+struct KeyIndex {
+  size_t key;
+  uint32_t index;
+};
+
+struct KeyOfIndex {
+  size_t operator()(const KeyIndex &e) const { return e.key; }
+};
+
+// Counters of the sort passes. Every index into them is computed by the pass
+// itself, so they skip the bounds check.
 template <typename T>
-void LinearStableSort(Vector<T> &v, std::function<size_t(T)> GetVal) {
-  if (v.Size() < 2) {
-    return;
+using ScratchVector = Vector<T, std::allocator<T>, UncheckedAccess>;
+
+// Histograms of (key >> shift) & mask over n keys placed every `stride`
+// words. The plain loop serializes on store-to-load forwarding whenever
+// neighbouring keys repeat, so the kernels below spread the increments over
+// kSubHistograms interleaved counters per bucket and sum them afterwards.
+inline void HistogramNaive(const size_t *keys, size_t stride, size_t n,
+                           size_t shift, size_t mask, size_t *count) {
+  for (size_t i(0); i < n; ++i) {
+    ++count[(keys[i * stride] >> shift) & mask];
   }
+}
 
-  size_t max_val = 0;
-  for (size_t i(0); i < v.Size(); ++i) {
-    max_val = std::max(max_val, GetVal(v[i]));
+inline void MergeSubHistograms(const uint32_t *sub, size_t buckets,
+                               size_t *count) {
+  for (size_t d(0); d < buckets; ++d) {
+    const uint32_t *s = sub + d * kSubHistograms;
+    count[d] += size_t(s[0]) + s[1] + s[2] + s[3];
   }
+}
 
-  Vector<int> count(max_val + 1, 0);
-  for (size_t i(0); i < v.Size(); ++i) {
-    ++count[GetVal(v[i])];
+inline void HistogramScalar(const size_t *keys, size_t stride, size_t n,
+                            size_t shift, size_t mask, size_t *count,
+                            size_t buckets) {
+  Vector<uint32_t> sub_histograms(buckets * kSubHistograms, 0);
+  uint32_t *sub = sub_histograms.Data();
+  size_t i(0);
+  for (; i + kSubHistograms <= n; i += kSubHistograms) {
+    const size_t *k = keys + i * stride;
+    ++sub[((k[0] >> shift) & mask) * kSubHistograms];
+    ++sub[((k[stride] >> shift) & mask) * kSubHistograms + 1];
+    ++sub[((k[2 * stride] >> shift) & mask) * kSubHistograms + 2];
+    ++sub[((k[3 * stride] >> shift) & mask) * kSubHistograms + 3];
   }
+  HistogramNaive(keys + i * stride, stride, n - i, shift, mask, count);
+  MergeSubHistograms(sub, buckets, count);
+}
 
-#ifdef DEBUG
-  std::cout << count << std::endl;
+#ifdef __x86_64__
+// Same as HistogramScalar, but four keys are gathered, shifted and masked
+// in one AVX2 register per step.
+__attribute__((target("avx2"))) inline void
+HistogramAvx2(const size_t *keys, size_t stride, size_t n, size_t shift,
+              size_t mask, size_t *count, size_t buckets) {
+  Vector<uint32_t> sub_histograms(buckets * kSubHistograms, 0);
+  uint32_t *sub = sub_histograms.Data();
+  const auto s = static_cast<long long>(stride);
+  const __m256i offsets = _mm256_setr_epi64x(0, s, 2 * s, 3 * s);
+  const __m128i shift_v = _mm_cvtsi64_si128(static_cast<long long>(shift));
+  const __m256i mask_v = _mm256_set1_epi64x(static_cast<long long>(mask));
+  alignas(32) uint64_t d[kSubHistograms];
+  size_t i(0);
+  for (; i + kSubHistograms <= n; i += kSubHistograms) {
+    const size_t *p = keys + i * stride;
+    __m256i k;
+    if (stride == 2) {
+      // Key/payload pairs: two plain loads and an unpack beat a gather.
+      const __m256i lo =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      const __m256i hi =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 4));
+      k = _mm256_unpacklo_epi64(lo, hi);
+    } else {
+      k = _mm256_i64gather_epi64(reinterpret_cast<const long long *>(p),
+                                 offsets, 8);
+    }
+    k = _mm256_and_si256(_mm256_srl_epi64(k, shift_v), mask_v);
+    _mm256_store_si256(reinterpret_cast<__m256i *>(d), k);
+    ++sub[d[0] * kSubHistograms];
+    ++sub[d[1] * kSubHistograms + 1];
+    ++sub[d[2] * kSubHistograms + 2];
+    ++sub[d[3] * kSubHistograms + 3];
+  }
+  HistogramNaive(keys + i * stride, stride, n - i, shift, mask, count);
+  MergeSubHistograms(sub, buckets, count);
+}
 #endif
 
-  for (size_t i(1); i < count.Size(); ++i) {
-    count[i] += count[i - 1];
+// Adds the histogram to count[0, buckets). Sub-histograms are used when they
+// stay cache-sized and their merge is cheap next to n increments. The AVX2
+// kernel is opt-in (AVX2_HISTOGRAM): spilling the lanes back to scalar
+// increments costs about what the vector load saves, see
+// lab-1/bench/histogram_bench.cpp.
+inline void Histogram(const size_t *keys, size_t stride, size_t n,
+                      size_t shift, size_t mask, size_t *count,
+                      size_t buckets) {
+  if (buckets > kSubHistogramMaxBuckets || buckets * kSubHistograms > n ||
+      n > UINT32_MAX) {
+    HistogramNaive(keys, stride, n, shift, mask, count);
+    return;
+  }
+#if defined(__x86_64__) && defined(AVX2_HISTOGRAM)
+  static const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+  if (kHasAvx2) {
+    HistogramAvx2(keys, stride, n, shift, mask, count, buckets);
+    return;
   }
-
-#ifdef DEBUG
-  std::cout << count << std::endl;
 #endif
-  Vector<T> res(v.Size());
+  HistogramScalar(keys, stride, n, shift, mask, count, buckets);
+}
 
-  for (int64_t i = v.Size() - 1; i >= 0; --i) {
-    res[--count[GetVal(v[i])]] = v[i];
+template <typename T, typename... P, typename Fn>
+void ChunkHistogram(const Vector<T, P...> &v, size_t begin, size_t end,
+                    const Fn &GetVal, size_t shift, size_t mask,
+                    size_t *count, size_t) {
+  for (size_t i(begin); i < end; ++i) {
+    ++count[(GetVal(v[i]) >> shift) & mask];
   }
+}
 
-#ifdef DEBUG
-  std::cout << res << std::endl;
-#endif
+// Keys of KeyIndex entries are contiguous with a fixed stride, which is what
+// the vectorized kernel needs.
+template <typename... P>
+void ChunkHistogram(const Vector<KeyIndex, P...> &v, size_t begin, size_t end,
+                    const KeyOfIndex &, size_t shift, size_t mask,
+                    size_t *count, size_t buckets) {
+  static_assert(sizeof(KeyIndex) % sizeof(size_t) == 0);
+  constexpr const size_t kStride = sizeof(KeyIndex) / sizeof(size_t);
+  Histogram(&v.Data()[begin].key, kStride, end - begin, shift, mask, count,
+            buckets);
+}
 
-  v = std::move(res);
+template <typename Fn> void RunChunks(size_t threads, Fn Work) {
+  if (threads < 2) {
+    Work(0);
+    return;
+  }
+  Vector<std::thread> pool(threads - 1);
+  for (size_t t(1); t < threads; ++t) {
+    pool[t - 1] = std::thread(Work, t);
+  }
+  Work(0);
+  for (size_t t(0); t + 1 < threads; ++t) {
+    pool[t].join();
+  }
+}
+
+// Threads a pass over n elements actually runs on: chunks smaller than
+// kParallelMinChunk are not worth a thread of their own.
+inline size_t PassThreads(size_t n, size_t threads) {
+  return std::max<size_t>(1, std::min(threads, n / kParallelMinChunk));
+}
+
+// Stable scatter of v into res by the digit (GetVal(v[i]) >> shift) & mask in
+// [0, buckets). Every thread builds a histogram of its own contiguous chunk,
+// the histograms are merged bucket-major into per-thread write offsets and
+// every thread then scatters its chunk, so the result does not depend on the
+// thread count. Returns false without touching res when all elements share
+// one digit.
+template <typename T, typename... P, typename Fn>
+bool ScatterPass(Vector<T, P...> &v, Vector<T, P...> &res, const Fn &GetVal,
+                 size_t shift, size_t mask, size_t buckets, size_t threads) {
+  const auto Digit = [&GetVal, shift, mask](const T &e) {
+    return (GetVal(e) >> shift) & mask;
+  };
+  const size_t n = v.Size();
+  threads = PassThreads(n, threads);
+  const size_t chunk = (n + threads - 1) / threads;
+  ScratchVector<size_t> count(threads * buckets, 0);
+
+  RunChunks(threads, [&](size_t t) {
+    const size_t begin = std::min(n, t * chunk);
+    const size_t end = std::min(n, (t + 1) * chunk);
+    ChunkHistogram(v, begin, end, GetVal, shift, mask,
+                   count.Data() + t * buckets, buckets);
+  });
+
+  const size_t first = Digit(v[0]);
+  size_t first_total = 0;
+  for (size_t t(0); t < threads; ++t) {
+    first_total += count[t * buckets + first];
+  }
+  if (first_total == n) {
+    return false;
+  }
+
+  size_t sum = 0;
+  for (size_t d(0); d < buckets; ++d) {
+    for (size_t t(0); t < threads; ++t) {
+      const size_t c = count[t * buckets + d];
+      count[t * buckets + d] = sum;
+      sum += c;
+    }
+  }
+
+  RunChunks(threads, [&](size_t t) {
+    const size_t base = t * buckets;
+    const size_t end = std::min(n, (t + 1) * chunk);
+    for (size_t i(t * chunk); i < end; ++i) {
+      res[count[base + Digit(v[i])]++] = std::move(v[i]);
+    }
+  });
+  return true;
+}
+
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void CountingStableSort(Vector<T, P...> &v, const Fn &GetVal, size_t max_val,
+                        size_t threads = 1) {
+  Vector<T, P...> res(v.Size());
+  if (ScatterPass(v, res, GetVal, 0, SIZE_MAX, max_val + 1, threads)) {
+    v = std::move(res);
+  }
+}
+
+// LSD radix sort over kRadixDigitBits-wide digits, memory is O(n + 2^digit)
+// whatever max_val is. Passes where every key has the same digit are skipped.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void RadixStableSort(Vector<T, P...> &v, const Fn &GetVal, size_t max_val,
+                     size_t threads = 1) {
+  Vector<T, P...> buf(v.Size());
+
+  for (size_t shift(0); shift < 64 && (max_val >> shift) != 0;
+       shift += kRadixDigitBits) {
+    if (ScatterPass(v, buf, GetVal, shift, kRadixDigitMask, kRadixDigitSize,
+                    threads)) {
+      std::swap(v, buf);
+    }
+  }
+}
+
+// Whether counting sort keeps its histograms within kCountingRangeFactor
+// times what radix passes need. Every thread of the pass holds its own
+// max_val + 1 counters, so the limit is threads * (max_val + 1) against
+// n + threads * 2^digit.
+inline bool UseCountingSort(size_t n, size_t max_val, size_t threads) {
+  threads = PassThreads(n, threads);
+  return max_val / kCountingRangeFactor < n / threads + kRadixDigitSize;
+}
+
+// Picks counting sort while UseCountingSort allows it, otherwise falls back
+// to LSD radix passes. With threads > 1 every pass is split over contiguous
+// chunks; the output is the same as the serial one.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+void LinearStableSort(Vector<T, P...> &v, const Fn &GetVal,
+                      size_t threads = 1) {
+  if (v.Size() < 2) {
+    return;
+  }
+
+  size_t max_val = 0;
+  for (size_t i(0); i < v.Size(); ++i) {
+    max_val = std::max(max_val, GetVal(v[i]));
+  }
+
+  if (UseCountingSort(v.Size(), max_val, threads)) {
+    CountingStableSort(v, GetVal, max_val, threads);
+  } else {
+    RadixStableSort(v, GetVal, max_val, threads);
+  }
+}
+
+// Stable order of v by GetVal as compact (key, index) entries, the records
+// themselves are not moved.
+template <typename T, typename... P, KeyExtractor<T> Fn>
+Vector<KeyIndex> SortedKeyIndex(const Vector<T, P...> &v, const Fn &GetVal,
+                                size_t threads = 1) {
+  if (v.Size() > UINT32_MAX) {
+    throw std::length_error("Too many elements for 32-bit indices");
+  }
+  Vector<KeyIndex> order(v.Size());
+  KeyIndex *entries = order.Data();
+  for (size_t i(0); i < v.Size(); ++i) {
+    entries[i] = {GetVal(v[i]), static_cast<uint32_t>(i)};
+  }
+  LinearStableSort(order, KeyOfIndex(), threads);
+  return order;
+}
+
+// Permutes v in place by following the cycles of order, one element at a
+// time, so there is no second array of T. The indices in order are consumed.
+template <typename T, typename... P, typename... Q>
+void ApplyOrder(Vector<T, P...> &v, Vector<KeyIndex, Q...> &order) {
+  for (size_t i(0); i < order.Size(); ++i) {
+    if (order[i].index == i) {
+      continue;
+    }
+    T tmp = std::move(v[i]);
+    size_t dst = i;
+    size_t src = order[i].index;
+    while (src != i) {
+      v[dst] = std::move(v[src]);
+      order[dst].index = dst;
+      dst = src;
+      src = order[src].index;
+    }
+    v[dst] = std::move(tmp);
+    order[dst].index = dst;
+  }
 }
 
 void LinearStableSort(Vector<int> &v) {
@@ -93,7 +381,166 @@ void Test() {
 
         AssertEqual(v, expected, std::to_string(__LINE__));
       }
+      {
+        const std::vector<std::pair<size_t, int>> expected = {
+            {0, 3},
+            {7, 6},
+            {1'000'000'000'000, 1},
+            {1'000'000'000'000, 7},
+            {1'000'000'002'048, 2},
+            {SIZE_MAX, 4}};
+
+        Vector<std::pair<size_t, int>> v = {
+            {1'000'000'000'000, 1}, {1'000'000'002'048, 2}, {0, 3},
+            {SIZE_MAX, 4}, {7, 6}, {1'000'000'000'000, 7}};
+
+        vector_tools::LinearStableSort<std::pair<size_t, int>>(
+            v, [](std::pair<size_t, int> p) { return p.first; });
+
+        AssertEqual(v, expected, std::to_string(__LINE__));
+      }
+      {
+        constexpr const size_t kSize = 1 << 18;
+        std::vector<std::pair<size_t, size_t>> expected;
+        Vector<std::pair<size_t, size_t>> v_counting;
+        Vector<std::pair<size_t, size_t>> v_radix;
+        for (size_t i(0); i < kSize; ++i) {
+          const size_t key = (i * 7919) % 1000;
+          expected.emplace_back(key, i);
+          v_counting.PushBack({key, i});
+          v_radix.PushBack({key << 40, i});
+        }
+        std::stable_sort(expected.begin(), expected.end(),
+                         [](const auto &l, const auto &r) {
+                           return l.first < r.first;
+                         });
+
+        vector_tools::LinearStableSort<std::pair<size_t, size_t>>(
+            v_counting, [](std::pair<size_t, size_t> p) { return p.first; },
+            4);
+        AssertEqual(v_counting, expected, std::to_string(__LINE__));
+
+        vector_tools::LinearStableSort<std::pair<size_t, size_t>>(
+            v_radix, [](std::pair<size_t, size_t> p) { return p.first; }, 4);
+        for (auto &p : expected) {
+          p.first <<= 40;
+        }
+        AssertEqual(v_radix, expected, std::to_string(__LINE__));
+      }
+      {
+        const std::vector<std::string> expected = {"c", "f", "b", "a",
+                                                   "g", "e", "d"};
+        Vector<std::pair<int, std::string>> v = {{4, "a"}, {2, "b"}, {0, "c"},
+                                                 {9, "d"}, {5, "e"}, {1, "f"},
+                                                 {4, "g"}};
+
+        auto order = vector_tools::SortedKeyIndex<std::pair<int, std::string>>(
+            v, [](const std::pair<int, std::string> &p) {
+              return static_cast<size_t>(p.first);
+            });
+        vector_tools::ApplyOrder(v, order);
+
+        Vector<std::string> values;
+        for (size_t i(0); i < v.Size(); ++i) {
+          values.PushBack(v[i].second);
+        }
+        AssertEqual(values, expected, std::to_string(__LINE__));
+      }
+
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test counting sort memory bound";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      // 1M keys below 8M: one histogram fits the bound, sixteen do not.
+      if (!vector_tools::UseCountingSort(1 << 20, (8 << 20) - 1, 1) ||
+          vector_tools::UseCountingSort(1 << 20, (8 << 20) - 1, 16))
+        throw TestError("Wrong sort choice: " + std::to_string(__LINE__));
+      // Whatever the thread count, the counting histograms stay within
+      // kCountingRangeFactor times what the radix passes hold.
+      for (size_t n : {size_t(100), size_t(1) << 16, size_t(1) << 20,
+                       size_t(1) << 24}) {
+        for (size_t threads(1); threads <= 256; threads *= 2) {
+          for (size_t max_val(1); max_val < (size_t(1) << 40); max_val *= 3) {
+            if (!vector_tools::UseCountingSort(n, max_val, threads))
+              continue;
+            const size_t t = vector_tools::PassThreads(n, threads);
+            if (t * (max_val + 1) >
+                kCountingRangeFactor * (n + t * kRadixDigitSize))
+              throw TestError("Histograms over the bound for n = " +
+                              std::to_string(n) + ", threads = " +
+                              std::to_string(threads) + ": " +
+                              std::to_string(__LINE__));
+          }
+        }
+      }
+      is_success = true;
+    } catch (const TestError &te) {
+      std::cout << kFailed << ' ' << kTestName << std::endl;
+      std::cout << kReason << ' ' << te.what() << std::endl;
+    }
+    if (is_success)
+      std::cout << kOk << ' ' << kTestName << std::endl;
+  } /////////////////////////////////////////////////////////////////
+
+  { /////////////////////////////////////////////////////////////////
+    constexpr const char *kTestName = "test histogram kernels";
+    std::cout << kRunning << ' ' << kTestName << std::endl;
+    bool is_success(false);
+    try {
+      constexpr const size_t kSize = 10007;
+      constexpr const size_t kBuckets = 1 << 11;
+      Vector<vector_tools::KeyIndex> entries(kSize);
+      for (size_t i(0); i < kSize; ++i) {
+        entries[i] = {(i % 7 == 0 ? i * 2654435761 : 42) << 11,
+                      static_cast<uint32_t>(i)};
+      }
+      const size_t *keys = &entries.Data()->key;
+      constexpr const size_t kStride =
+          sizeof(vector_tools::KeyIndex) / sizeof(size_t);
+
+      std::vector<size_t> expected(kBuckets, 0);
+      vector_tools::HistogramNaive(keys, kStride, kSize, 11, kBuckets - 1,
+                                   expected.data());
+      std::vector<size_t> scalar(kBuckets, 0);
+      vector_tools::HistogramScalar(keys, kStride, kSize, 11, kBuckets - 1,
+                                    scalar.data(), kBuckets);
+      if (scalar != expected)
+        throw TestError("Scalar histogram differs: " +
+                        std::to_string(__LINE__));
+#ifdef __x86_64__
+      if (__builtin_cpu_supports("avx2")) {
+        std::vector<size_t> avx2(kBuckets, 0);
+        vector_tools::HistogramAvx2(keys, kStride, kSize, 11, kBuckets - 1,
+                                    avx2.data(), kBuckets);
+        if (avx2 != expected)
+          throw TestError("AVX2 histogram differs: " +
+                          std::to_string(__LINE__));
+      }
+#endif
 
+      std::vector<size_t> sorted;
+      for (size_t i(0); i < kSize; ++i) {
+        sorted.push_back(entries[i].key);
+      }
+      std::stable_sort(sorted.begin(), sorted.end());
+      vector_tools::LinearStableSort(entries, vector_tools::KeyOfIndex());
+      for (size_t i(0); i < kSize; ++i) {
+        if (entries[i].key != sorted[i] ||
+            (i > 0 && entries[i].key == entries[i - 1].key &&
+             entries[i].index < entries[i - 1].index))
+          throw TestError("Wrong order on position [" + std::to_string(i) +
+                          "] : " + std::to_string(__LINE__));
+      }
       is_success = true;
     } catch (const TestError &te) {
       std::cout << kFailed << ' ' << kTestName << std::endl;
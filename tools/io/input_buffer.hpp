@@ -0,0 +1,170 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+constexpr const size_t kInputBlockSize = 1 << 20;
+}
+
+namespace tools::io {
+
+// The whole input as one contiguous read-only buffer. Regular files
+// (including a redirected stdin) are mmap-ed, anything else is slurped in
+// large blocks. An empty path or "-" means stdin.
+class InputBuffer {
+public:
+  explicit InputBuffer(const std::string &path = "") {
+    const bool is_stdin = path.empty() || path == "-";
+    const int fd = is_stdin ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("Can't open " + path);
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      const off_t offset = is_stdin ? lseek(fd, 0, SEEK_CUR) : 0;
+      if (offset >= 0 && offset < st.st_size) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+          madvise(map, st.st_size, MADV_SEQUENTIAL);
+          map_ = static_cast<char *>(map);
+          map_size_ = st.st_size;
+          data_ = map_ + offset;
+          size_ = map_size_ - offset;
+        }
+      }
+    }
+    if (!map_) {
+      Slurp(fd);
+    }
+    if (!is_stdin) {
+      close(fd);
+    }
+  }
+
+  InputBuffer(const InputBuffer &) = delete;
+  InputBuffer &operator=(const InputBuffer &) = delete;
+
+  ~InputBuffer() {
+    if (map_) {
+      munmap(map_, map_size_);
+    } else {
+      free(data_);
+    }
+  }
+
+  [[nodiscard]] const char *Data() const noexcept { return data_; }
+  [[nodiscard]] size_t Size() const noexcept { return size_; }
+
+private:
+  void Slurp(int fd) {
+    size_t capacity = 0;
+    while (true) {
+      if (size_ == capacity) {
+        capacity = capacity ? capacity * 2 : kInputBlockSize;
+        char *grown = static_cast<char *>(realloc(data_, capacity));
+        if (!grown) {
+          free(data_);
+          throw std::bad_alloc();
+        }
+        data_ = grown;
+      }
+      const ssize_t got = read(fd, data_ + size_, capacity - size_);
+      if (got < 0) {
+        free(data_);
+        throw std::runtime_error("Can't read input");
+      }
+      if (got == 0) {
+        return;
+      }
+      size_ += got;
+    }
+  }
+
+  char *map_ = nullptr;
+  size_t map_size_ = 0;
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+inline bool IsSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Extracts "key value" records from a buffer the way
+// `std::cin >> key >> value` would: tokens are separated by any whitespace,
+// the key is an unsigned decimal number, the value is a view into the buffer.
+class RecordParser {
+public:
+  RecordParser(const char *data, size_t size)
+      : pos_(data), end_(data + size) {}
+
+  bool Next(size_t &key, std::string_view &value) {
+    SkipSpaces();
+    const char *digits = pos_;
+    key = 0;
+    while (pos_ != end_ && *pos_ >= '0' && *pos_ <= '9') {
+      const size_t digit = *pos_ - '0';
+      if (key > (SIZE_MAX - digit) / 10) {
+        return false;
+      }
+      key = key * 10 + digit;
+      ++pos_;
+    }
+    if (pos_ == digits) {
+      return false;
+    }
+
+    SkipSpaces();
+    const char *begin = pos_;
+    while (pos_ != end_ && !IsSpace(*pos_)) {
+      ++pos_;
+    }
+    value = std::string_view(begin, pos_ - begin);
+    return !value.empty();
+  }
+
+private:
+  void SkipSpaces() {
+    while (pos_ != end_ && IsSpace(*pos_)) {
+      ++pos_;
+    }
+  }
+
+  const char *pos_;
+  const char *end_;
+};
+
+#ifdef DEBUG
+
+namespace input_buffer_test {
+
+void Test() {
+  const std::string input = "000012\tabc\n7  d\r\n 000003\tefgh\n42";
+  RecordParser parser(input.data(), input.size());
+  [[maybe_unused]] size_t key;
+  std::string_view value;
+
+  assert(parser.Next(key, value) && key == 12 && value == "abc");
+  assert(parser.Next(key, value) && key == 7 && value == "d");
+  assert(parser.Next(key, value) && key == 3 && value == "efgh");
+  assert(!parser.Next(key, value));
+}
+
+} // namespace input_buffer_test
+
+#endif
+
+} // namespace tools::io
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace {
+constexpr const size_t kOutputBufferSize = 1 << 20;
+} // namespace
+
+namespace tools::io {
+
+namespace {
+
+struct DigitPairs {
+  char data[200];
+
+  constexpr DigitPairs() : data() {
+    for (int i(0); i < 100; ++i) {
+      data[2 * i] = static_cast<char>('0' + i / 10);
+      data[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+  }
+};
+
+constexpr const DigitPairs kDigitPairs;
+
+} // namespace
+
+// Buffered writer straight to a file descriptor. Payloads that don't fit in
+// the free part of the buffer go out together with it in one writev.
+class OutputBuffer {
+public:
+  explicit OutputBuffer(int fd = STDOUT_FILENO,
+                        size_t capacity = kOutputBufferSize)
+      : fd_(fd), capacity_(capacity) {
+    data_ = static_cast<char *>(malloc(capacity_));
+    if (!data_) {
+      throw std::bad_alloc();
+    }
+  }
+
+  OutputBuffer(const OutputBuffer &) = delete;
+  OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+  ~OutputBuffer() {
+    try {
+      Flush();
+    } catch (const std::runtime_error &) {
+    }
+    free(data_);
+  }
+
+  void Put(char c) {
+    if (size_ == capacity_) {
+      Flush();
+    }
+    data_[size_++] = c;
+  }
+
+  void Write(std::string_view s) {
+    if (s.size() <= capacity_ - size_) {
+      memcpy(data_ + size_, s.data(), s.size());
+      size_ += s.size();
+      return;
+    }
+    iovec iov[2] = {{data_, size_},
+                    {const_cast<char *>(s.data()), s.size()}};
+    WriteAll(iov, 2);
+    size_ = 0;
+  }
+
+  // Same bytes as `os << std::setw(width) << std::setfill('0') << value`.
+  void WriteZeroPadded(size_t value, size_t width) {
+    char digits[20];
+    char *p = digits + sizeof(digits);
+    while (value >= 100) {
+      p -= 2;
+      memcpy(p, kDigitPairs.data + 2 * (value % 100), 2);
+      value /= 100;
+    }
+    if (value >= 10) {
+      p -= 2;
+      memcpy(p, kDigitPairs.data + 2 * value, 2);
+    } else {
+      *--p = static_cast<char>('0' + value);
+    }
+
+    const size_t len = digits + sizeof(digits) - p;
+    const size_t pad = width > len ? width - len : 0;
+    if (pad + len > capacity_ - size_) {
+      Flush();
+    }
+    memset(data_ + size_, '0', pad);
+    memcpy(data_ + size_ + pad, p, len);
+    size_ += pad + len;
+  }
+
+  void Flush() {
+    iovec iov = {data_, size_};
+    WriteAll(&iov, 1);
+    size_ = 0;
+  }
+
+private:
+  void WriteAll(iovec *iov, int count) {
+    while (count > 0) {
+      const ssize_t done = writev(fd_, iov, count);
+      if (done < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw std::runtime_error("Can't write output");
+      }
+      size_t rest = done;
+      while (count > 0 && rest >= iov->iov_len) {
+        rest -= iov->iov_len;
+        ++iov;
+        --count;
+      }
+      if (count > 0) {
+        iov->iov_base = static_cast<char *>(iov->iov_base) + rest;
+        iov->iov_len -= rest;
+      }
+    }
+  }
+
+  int fd_;
+  char *data_;
+  size_t size_ = 0;
+  size_t capacity_;
+};
+
+#ifdef DEBUG
+
+namespace output_buffer_test {
+
+void Test() {
+  FILE *file = tmpfile();
+  {
+    OutputBuffer out(fileno(file), 8);
+    out.WriteZeroPadded(42, 6);
+    out.Put('\t');
+    out.Write("a long value over the capacity");
+    out.Put('\n');
+    out.WriteZeroPadded(1234567, 6);
+    out.WriteZeroPadded(0, 1);
+  }
+  rewind(file);
+  char buf[64] = {};
+  [[maybe_unused]] const size_t got = fread(buf, 1, sizeof(buf) - 1, file);
+  fclose(file);
+  assert(std::string(buf, got) ==
+         "000042\ta long value over the capacity\n12345670");
+}
+
+} // namespace output_buffer_test
+
+#endif
+
+} // namespace tools::io
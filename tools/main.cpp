@@ -7,11 +7,31 @@
 #include "containers/vector.hpp"
 #include "containers/vector_tools.hpp"
 #include "containers/avl_tree.hpp"
+#include "containers/btree.hpp"
+#include "containers/bucket_chains.hpp"
+#include "containers/concurrent_vector.hpp"
+#include "containers/small_vector.hpp"
+#include "containers/string_pool.hpp"
+#include "io/input_buffer.hpp"
+#include "io/output_buffer.hpp"
+#include "memory/alloc_stats.hpp"
+#include "memory/arena.hpp"
+#include "memory/slab_pool.hpp"
 
 int main() {
 //  tools::containers::string_test::Test();
 //  tools::containers::vector_test::Test();
 //  tools::containers::vector_tools_test::Test();
+//  tools::containers::btree_test::Test();
+//  tools::containers::bucket_chains_test::Test();
+//  tools::containers::concurrent_vector_test::Test();
+//  tools::containers::small_vector_test::Test();
+//  tools::containers::string_pool_test::Test();
+//  tools::io::input_buffer_test::Test();
+//  tools::io::output_buffer_test::Test();
+//  tools::memory::arena_test::Test();
+//  tools::memory::alloc_stats_test::Test();
+//  tools::memory::slab_pool_test::Test();
 
 
   return 0;
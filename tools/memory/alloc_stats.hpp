@@ -0,0 +1,151 @@
+#pragma once
+#include <cstddef>
+#include <iostream>
+
+#ifdef ALLOC_STATS
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <initializer_list>
+#endif
+
+namespace tools::memory {
+
+// Container families that report their heap traffic.
+enum class AllocSite {
+  kVector,
+  kSmallVector,
+  kString,
+  kAVLTree,
+  kBTree,
+  kStringPool,
+  kSiteCount
+};
+
+// Opt-in heap accounting: build with -DALLOC_STATS to count, per container
+// family, the buffers taken and given back, how many of them replaced a
+// smaller buffer on growth, and the bytes live now and at peak. Without the
+// flag every hook below is an empty inline function and compiles away.
+//
+// Bytes are what the container asked for, not what malloc rounded them up to.
+// Storage placed in an Arena is counted where the container requested it;
+// the arena's own blocks are not counted again.
+#ifdef ALLOC_STATS
+
+namespace alloc_stats_internal {
+
+struct Counters {
+  std::atomic<size_t> allocations{0};
+  std::atomic<size_t> deallocations{0};
+  std::atomic<size_t> reallocations{0};
+  std::atomic<size_t> live_bytes{0};
+  std::atomic<size_t> peak_bytes{0};
+};
+
+// One slot per site plus a process-wide total, so the total peak is a real
+// high-water mark rather than a sum of peaks reached at different times.
+inline Counters &Slot(AllocSite site) {
+  static Counters table[static_cast<size_t>(AllocSite::kSiteCount) + 1];
+  return table[static_cast<size_t>(site)];
+}
+
+inline void AddLive(Counters &c, size_t bytes) {
+  const size_t live =
+      c.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  size_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+  while (peak < live && !c.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+} // namespace alloc_stats_internal
+
+inline void RecordAllocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->allocations.fetch_add(1, std::memory_order_relaxed);
+    alloc_stats_internal::AddLive(*c, bytes);
+  }
+}
+
+inline void RecordDeallocation(AllocSite site, size_t bytes) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->deallocations.fetch_add(1, std::memory_order_relaxed);
+    c->live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+}
+
+// Marks that a live buffer was replaced by a bigger one. The new buffer and
+// the release of the old one are recorded separately.
+inline void RecordReallocation(AllocSite site) {
+  using alloc_stats_internal::Slot;
+  for (auto *c : {&Slot(site), &Slot(AllocSite::kSiteCount)}) {
+    c->reallocations.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+inline void DumpAllocStats(std::ostream &os) {
+  static const char *const kNames[] = {"Vector",  "SmallVector", "String",
+                                       "AVLTree", "BTree",       "StringPool",
+                                       "total"};
+  char line[128];
+  std::snprintf(line, sizeof(line), "%-12s %12s %12s %12s %14s %14s\n",
+                "alloc stats", "allocs", "frees", "reallocs", "live bytes",
+                "peak bytes");
+  os << line;
+  for (size_t i(0); i <= static_cast<size_t>(AllocSite::kSiteCount); ++i) {
+    const auto &c = alloc_stats_internal::Slot(static_cast<AllocSite>(i));
+    std::snprintf(line, sizeof(line), "%-12s %12zu %12zu %12zu %14zu %14zu\n",
+                  kNames[i], c.allocations.load(), c.deallocations.load(),
+                  c.reallocations.load(), c.live_bytes.load(),
+                  c.peak_bytes.load());
+    os << line;
+  }
+  os.flush();
+}
+
+// Prints the table to stderr when the program exits. Call once from main;
+// repeated calls register a single dump.
+inline void DumpAllocStatsAtExit() {
+  static const bool registered =
+      std::atexit([] { DumpAllocStats(std::cerr); }) == 0;
+  (void)registered;
+}
+
+#else
+
+inline void RecordAllocation(AllocSite, size_t) {}
+inline void RecordDeallocation(AllocSite, size_t) {}
+inline void RecordReallocation(AllocSite) {}
+inline void DumpAllocStats(std::ostream &) {}
+inline void DumpAllocStatsAtExit() {}
+
+#endif
+
+#if defined(DEBUG) && defined(ALLOC_STATS)
+
+namespace alloc_stats_test {
+
+void Test() {
+  const auto &c = alloc_stats_internal::Slot(AllocSite::kVector);
+  const size_t allocations = c.allocations.load();
+  const size_t live = c.live_bytes.load();
+  RecordAllocation(AllocSite::kVector, 100);
+  RecordAllocation(AllocSite::kVector, 200);
+  RecordReallocation(AllocSite::kVector);
+  RecordDeallocation(AllocSite::kVector, 100);
+  assert(c.allocations.load() == allocations + 2);
+  assert(c.live_bytes.load() == live + 200);
+  assert(c.peak_bytes.load() >= live + 300);
+  RecordDeallocation(AllocSite::kVector, 200);
+  assert(c.live_bytes.load() == live);
+  DumpAllocStats(std::cout);
+}
+
+} // namespace alloc_stats_test
+
+#endif
+
+} // namespace tools::memory
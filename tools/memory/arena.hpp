@@ -0,0 +1,223 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace {
+constexpr const size_t kArenaBlockSize = 1 << 16;
+constexpr const size_t kArenaAlignment = alignof(std::max_align_t);
+constexpr const size_t kArenaSizeClasses = 16;
+} // namespace
+
+namespace tools::memory {
+
+// Monotonic allocator: hands out memory by bumping a pointer through large
+// blocks and gives it all back at once in Release() or the destructor, so a
+// batch of objects costs one system allocation per block and is freed in
+// O(blocks) regardless of how many objects it held.
+//
+// With recycle enabled, deallocated chunks of up to
+// kArenaSizeClasses * kArenaAlignment bytes are kept on per-size free lists
+// and handed out again, which keeps node churn (insert/erase in a tree) from
+// growing the arena without bound. Bigger chunks are only reclaimed on
+// Release().
+class Arena {
+public:
+  explicit Arena(size_t block_size = kArenaBlockSize, bool recycle = false)
+      : block_size_(block_size), recycle_(recycle) {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  ~Arena() { Release(); }
+
+  void *Allocate(size_t size, size_t alignment = kArenaAlignment) {
+    const bool recyclable = IsRecyclable(size, alignment);
+    if (recyclable) {
+      const size_t size_class = SizeClass(size);
+      if (free_[size_class] != nullptr) {
+        FreeChunk *chunk = free_[size_class];
+        free_[size_class] = chunk->next;
+        return chunk;
+      }
+      size = (size_class + 1) * kArenaAlignment;
+    }
+
+    uintptr_t begin = AlignUp(current_, alignment);
+    if (begin + size > end_ || current_ == 0) {
+      if (size + alignment > block_size_ / 2) {
+        // Oversized requests get a block of their own so the current one is
+        // not abandoned half-used.
+        Block *block = NewBlock(size + alignment);
+        if (head_ == nullptr) {
+          head_ = block;
+        } else {
+          block->next = head_->next;
+          head_->next = block;
+        }
+        return reinterpret_cast<void *>(
+            AlignUp(reinterpret_cast<uintptr_t>(block + 1), alignment));
+      }
+      Block *block = NewBlock(block_size_);
+      block->next = head_;
+      head_ = block;
+      current_ = reinterpret_cast<uintptr_t>(block + 1);
+      end_ = current_ + block_size_;
+      begin = AlignUp(current_, alignment);
+    }
+    current_ = begin + size;
+    return reinterpret_cast<void *>(begin);
+  }
+
+  void Deallocate(void *data, size_t size,
+                  size_t alignment = kArenaAlignment) noexcept {
+    if (data == nullptr || !IsRecyclable(size, alignment)) {
+      return;
+    }
+    FreeChunk *chunk = static_cast<FreeChunk *>(data);
+    chunk->next = free_[SizeClass(size)];
+    free_[SizeClass(size)] = chunk;
+  }
+
+  // Returns every block to the system. Objects placed in the arena are not
+  // destroyed, so this is meant for trivially destructible data or for
+  // containers that already ran their destructors.
+  void Release() noexcept {
+    while (head_ != nullptr) {
+      Block *next = head_->next;
+      ::operator delete(head_);
+      head_ = next;
+    }
+    current_ = end_ = 0;
+    reserved_ = 0;
+    for (FreeChunk *&chunk : free_) {
+      chunk = nullptr;
+    }
+  }
+
+  // Bytes currently held from the system, block headers included.
+  [[nodiscard]] size_t Reserved() const noexcept { return reserved_; }
+
+private:
+  struct alignas(kArenaAlignment) Block {
+    Block *next;
+  };
+
+  struct FreeChunk {
+    FreeChunk *next;
+  };
+
+  static uintptr_t AlignUp(uintptr_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(uintptr_t(alignment) - 1);
+  }
+
+  static size_t SizeClass(size_t size) {
+    return size == 0 ? 0 : (size - 1) / kArenaAlignment;
+  }
+
+  [[nodiscard]] bool IsRecyclable(size_t size, size_t alignment) const {
+    return recycle_ && alignment <= kArenaAlignment &&
+           SizeClass(size) < kArenaSizeClasses;
+  }
+
+  Block *NewBlock(size_t size) {
+    const size_t bytes = sizeof(Block) + size;
+    Block *block = static_cast<Block *>(::operator new(bytes));
+    block->next = nullptr;
+    reserved_ += bytes;
+    return block;
+  }
+
+  Block *head_ = nullptr;
+  uintptr_t current_ = 0;
+  uintptr_t end_ = 0;
+  size_t block_size_;
+  size_t reserved_ = 0;
+  bool recycle_;
+  FreeChunk *free_[kArenaSizeClasses] = {};
+};
+
+// Standard allocator interface over an Arena, so any allocator-aware
+// container (ours or std::) can place its storage there. Copies share the
+// arena, and the allocator propagates with the container's buffer.
+template <typename T> class ArenaAllocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+  using is_always_equal = std::false_type;
+
+  explicit ArenaAllocator(Arena &arena) noexcept : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) noexcept
+      : arena_(other.GetArena()) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T *data, size_t n) noexcept {
+    arena_->Deallocate(data, n * sizeof(T), alignof(T));
+  }
+
+  [[nodiscard]] Arena *GetArena() const noexcept { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U> &other) const noexcept {
+    return arena_ == other.GetArena();
+  }
+
+private:
+  Arena *arena_;
+};
+
+#ifdef DEBUG
+
+namespace arena_test {
+
+void Test() {
+  {
+    Arena arena(1024);
+    [[maybe_unused]] auto *a = static_cast<char *>(arena.Allocate(3, 1));
+    [[maybe_unused]] auto *b =
+        static_cast<double *>(arena.Allocate(sizeof(double), 8));
+    assert(reinterpret_cast<uintptr_t>(b) % alignof(double) == 0);
+    assert(a + 3 <= reinterpret_cast<char *>(b));
+    [[maybe_unused]] const size_t reserved = arena.Reserved();
+    [[maybe_unused]] void *big = arena.Allocate(4096);
+    assert(big != nullptr && arena.Reserved() > reserved + 4096);
+    // The oversized block must not have replaced the current one.
+    assert(static_cast<char *>(arena.Allocate(1, 1)) > a);
+    arena.Release();
+    assert(arena.Reserved() == 0);
+  }
+  {
+    Arena arena(kArenaBlockSize, true);
+    void *a = arena.Allocate(24);
+    arena.Deallocate(a, 24);
+    assert(arena.Allocate(17) == a);
+    assert(arena.Allocate(24) != a);
+  }
+  {
+    Arena arena;
+    std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>(arena)};
+    for (int i(0); i < 100000; ++i) {
+      v.push_back(i);
+    }
+    for (int i(0); i < 100000; ++i) {
+      assert(v[i] == i);
+    }
+    assert(ArenaAllocator<char>(arena) == v.get_allocator());
+  }
+}
+
+} // namespace arena_test
+
+#endif
+
+} // namespace tools::memory
@@ -0,0 +1,123 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+#include "alloc_stats.hpp"
+
+namespace {
+constexpr const size_t kSlabBytes = 1 << 16;
+} // namespace
+
+namespace tools::memory {
+
+// Pool of uninitialized slots for objects of one type. Slots are cut from
+// slabs of about kSlabBytes, taken from Alloc, in address order, and freed
+// slots go onto an intrusive free list that Allocate drains first, so in a
+// steady insert/erase mix no call reaches the underlying allocator. Slabs
+// are only given back all at once, by Release() or the destructor; it is up
+// to the owner to destroy the objects first.
+template <typename T, typename Alloc = std::allocator<T>> class SlabPool {
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+
+  static constexpr size_t kSlotsPerSlab =
+      sizeof(Slot) * 2 > kSlabBytes ? 2 : kSlabBytes / sizeof(Slot);
+
+  struct Slab {
+    Slab *next;
+    Slot slots[kSlotsPerSlab];
+  };
+
+  using SlabAlloc =
+      typename std::allocator_traits<Alloc>::template rebind_alloc<Slab>;
+  using SlabTraits = std::allocator_traits<SlabAlloc>;
+
+public:
+  explicit SlabPool(AllocSite site, const Alloc &alloc = Alloc())
+      : alloc_(alloc), site_(site) {}
+
+  SlabPool(const SlabPool &) = delete;
+  SlabPool &operator=(const SlabPool &) = delete;
+
+  ~SlabPool() { Release(); }
+
+  // Memory for one T; construct it with placement new.
+  T *Allocate() {
+    if (free_ != nullptr) {
+      Slot *slot = free_;
+      free_ = slot->next;
+      return reinterpret_cast<T *>(slot);
+    }
+    if (used_ == kSlotsPerSlab) {
+      Slab *slab = SlabTraits::allocate(alloc_, 1);
+      RecordAllocation(site_, sizeof(Slab));
+      slab->next = slabs_;
+      slabs_ = slab;
+      used_ = 0;
+    }
+    return reinterpret_cast<T *>(slabs_->slots[used_++].bytes);
+  }
+
+  // Takes back a slot whose object was already destroyed.
+  void Deallocate(T *data) noexcept {
+    Slot *slot = reinterpret_cast<Slot *>(data);
+    slot->next = free_;
+    free_ = slot;
+  }
+
+  void Release() noexcept {
+    while (slabs_ != nullptr) {
+      Slab *next = slabs_->next;
+      RecordDeallocation(site_, sizeof(Slab));
+      SlabTraits::deallocate(alloc_, slabs_, 1);
+      slabs_ = next;
+    }
+    free_ = nullptr;
+    used_ = kSlotsPerSlab;
+  }
+
+  [[nodiscard]] SlabAlloc GetAllocator() const { return alloc_; }
+
+private:
+  Slab *slabs_ = nullptr;
+  Slot *free_ = nullptr;
+  // Slots handed out from the newest slab; kSlotsPerSlab means "no room".
+  size_t used_ = kSlotsPerSlab;
+  [[no_unique_address]] SlabAlloc alloc_;
+  AllocSite site_;
+};
+
+#ifdef DEBUG
+
+namespace slab_pool_test {
+
+void Test() {
+  SlabPool<double> pool(AllocSite::kAVLTree);
+  double *a = pool.Allocate();
+  [[maybe_unused]] double *b = pool.Allocate();
+  assert(b == a + 1);
+  pool.Deallocate(a);
+  assert(pool.Allocate() == a);
+
+  // Slots never overlap, also across slabs.
+  std::unique_ptr<double *[]> slots(new double *[100000]);
+  for (size_t i(0); i < 100000; ++i) {
+    slots[i] = pool.Allocate();
+    *slots[i] = static_cast<double>(i);
+  }
+  for (size_t i(0); i < 100000; ++i) {
+    assert(*slots[i] == static_cast<double>(i));
+  }
+  pool.Release();
+  assert(pool.Allocate() != nullptr);
+}
+
+} // namespace slab_pool_test
+
+#endif
+
+} // namespace tools::memory